@@ -1,9 +1,12 @@
-#include <math.h>
 #include <FEHLCD.h>
 #include <FEHIO.h>
 #include <FEHMotor.h>
 #include <FEHRCS.h>
 #include <FEHServo.h>
+#include <FEHBattery.h>
+#include <FEHSD.h>
+#include <math.h>
+#include <stdlib.h>
 
 // ----------- PORT AND MACRO DECLARATIONS -----------
 
@@ -14,10 +17,85 @@
 #define FORWARD 1 // Value used to represent motion forward
 #define COUNTS_PER_REVOLUTION 318 // Number of counts that correspond to a full motor revolution for IGWAN motors 
 #define RADIUS_OF_TURN 4 // Radius of robot turn in inches measured from the middle of the wheel to the center of the chassis
+#define WHEEL_RADIUS 1.5f // Radius of the drive wheels in inches
+#define PI 3.14159265f // Single precision pi, the Proteus has no FPU so double math is avoided entirely
+#define COUNTS_PER_INCH (COUNTS_PER_REVOLUTION / (2.f * PI * WHEEL_RADIUS)) // Encoder counts per inch of wheel travel
+#define HEADING_KP 0.6f // Proportional gain of the straight-line controller in percent per count of wheel difference
+#define HEADING_KI 4.0f // Integral gain of the straight-line controller in percent per count-second of wheel difference
+#define HEADING_MAX_CORRECTION 15.f // Largest percent the straight-line controller may shift between the wheels
+#define CONTROL_PERIOD_MS 10 // Update period of the motion controllers and speed profiles in milliseconds
+#define TURN_SPEED 50.f // Default peak motor percent of turns in place, both wheels are held together so turns run faster than straight segments
+#define PROFILE_START_PERCENT 25.f // Motor percent at which every speed profile starts and ends, just above where the wheels break free
+#define PROFILE_ACCEL 12.f // Motor percent gained per inch of wheel travel while ramping up to the peak speed
+#define PROFILE_DECEL 8.f // Motor percent shed per inch of wheel travel while ramping down to the target
+#define TRACK_WIDTH (2.f * RADIUS_OF_TURN) // Distance between the wheel contact points in inches
+#define START_X 0.f // x of the robot at the start of the run in inches; the course origin is the start light, y points up the course
+#define START_Y -2.f // y of the robot at the start of the run in inches
+#define START_HEADING 90.f // Heading of the robot at the start of the run in degrees, counterclockwise from the x axis
+#define BLEND_MAX_ANGLE 10.f // Largest turn in degrees between two straight segments that is steered in without stopping
 #define TEAM_ID "B5rhNym2B" // Team identifier used for RCS system 
 #define SERVO_MIN 1291 // Minimum compensation value for the servo motor, run TouchCalibrate() to obtain
 #define SERVO_MAX 2313 // Maximum compensation value for the servo motor, run TouchCalibrate() to obtain
-#define COLOR_THRESHOLD 1.7 // Threshold used for differentiating between red and blue lights, > 1.7 corresponds to blue and < 1.7 corresponds to red
+#define LIGHT_UNKNOWN 0 // Value used to represent a ticket booth light that has not been read
+#define LIGHT_RED 1 // Value used to represent a red ticket booth light
+#define LIGHT_BLUE 2 // Value used to represent a blue ticket booth light
+#define COLOR_THRESHOLD 1.7f // Threshold used for differentiating between red and blue lights, > 1.7 corresponds to blue and < 1.7 corresponds to red; used until calibrate_light_thresholds() has stored one
+#define LIGHT_CONFIDENCE 0.999f // Probability of being right at which read_light_color() stops sampling and decides on a color
+#define LIGHT_MIN_SAMPLES 4 // CdS samples read_light_color() takes before it trusts its estimate of the noise
+#define LIGHT_TIMEOUT_MS 500 // Longest read_light_color() samples before giving up and reporting the light as unknown
+#define CDS_NOISE_FLOOR 0.02f // Smallest noise in volts read_light_color() assumes, keeps a few lucky samples from looking certain
+#define START_LIGHT_THRESHOLD 2.0f // CdS voltage at or below which the start light counts as on when the ambient baseline cannot be trusted
+#define START_LIGHT_DROP 0.15f // Fraction the CdS voltage has to fall below the ambient baseline for the start light to count as on
+#define START_LIGHT_RELEASE 0.08f // Fraction below the baseline the CdS voltage has to come back above to count as off again
+#define START_NOISE_SIGMAS 6.f // Standard deviations of the ambient noise the start light drop has to exceed at the least
+#define START_MAX_DROP 0.5f // Largest drop the noise may ask for; a noisier baseline falls back to START_LIGHT_THRESHOLD
+#define START_CONFIRM_SAMPLES 3 // Consecutive samples past the drop needed before the start light counts as on
+#define START_SAMPLE_MS 1 // Time between the samples of the start light detector
+#define START_BASELINE_MS 250 // Time init() samples the ambient light for the start light baseline
+#define START_TRACK_MS 1000 // Time constant with which the start light detector follows the ambient light while it waits
+#define START_TOUCH_MS 100 // Time between the checks for a touch that asks for calibration while the robot waits for the start light
+#define TICKET_LIGHT_THRESHOLD 2.2f // CdS voltage at or below which move_to_light() considers the ticket booth light reached; used until calibrate_light_thresholds() has stored one
+#define THRESHOLD_FILE "light_thresholds.txt" // SD card file calibrate_light_thresholds() stores the light thresholds in
+#define CALIBRATION_MS 1000 // Time calibrate_light_thresholds() samples each light for
+#define CALIBRATION_MIN_SEPARATION 3.f // Standard deviations two calibrated lights have to lie apart, in sum, to place a threshold between them
+#define LIGHT_APPROACH_SPEED 60.f // Peak motor percent of move_to_light(), it slows down on its own as the light comes near
+#define LIGHT_DECEL 40.f // Motor percent shed per inch of predicted distance to the ticket booth light
+#define LIGHT_MIN_SLOPE 1.5f // Fall of the CdS voltage in volts per second that counts as the light coming near, well above the slope noise
+#define LIGHT_MAX_OVERRUN 1.5f // Inches move_to_light() crawls past the threshold looking for the brightest point before it stops anyway
+#define CDS_OVERSAMPLE 4 // ADC reads averaged into every CdS sample
+#define CDS_WINDOW 8 // CdS samples kept in the ring buffer the slope and variance are computed over
+#define CDS_MEDIAN 5 // Latest CdS samples the median filter picks from, rejects single sample spikes
+#define CDS_FILTER 0.5f // Weight of each new median in the exponential average of the CdS cell
+#define CDS_DARK 3.3f // CdS voltage reported before the first sample, the reading of a cell that sees no light
+#define MAX_TASKS 8 // Maximum number of tasks the scheduler can hold
+#define MOTION_PERIOD_MS 1 // Period of the motion task, checks stop conditions at 1 kHz
+#define SENSOR_PERIOD_MS 5 // Period of the sensor task, samples the CdS cell at 200 Hz
+#define DISPLAY_PERIOD_MS 100 // Period of the display task, refreshes the LCD at 10 Hz
+#define ENCODER_SNAPSHOT_TRIES 3 // Attempts read_encoders() makes to read both encoders without either changing
+#define SETTLE_WINDOW_MS 40 // Time both encoders have to hold still before settle() considers the robot at rest
+#define SETTLE_TIMEOUT_MS 500 // Longest settle() waits for the robot to come to rest
+#define BATTERY_PERIOD_MS 20 // Period of the battery task, samples the battery voltage at 50 Hz
+#define BATTERY_NOMINAL_VOLTAGE 11.5f // Battery voltage the speed profiles and turn angles were tuned at
+#define BATTERY_FILTER 0.1f // Weight of each new battery sample in the running average, smooths out ADC noise and load spikes
+#define MIN_COMPENSATION 0.8f // Lowest factor battery compensation may scale the motor percents by, guards against bad readings
+#define MAX_COMPENSATION 1.3f // Highest factor battery compensation may scale the motor percents by
+#define FF_FILE "motor_ff.txt" // SD card file characterize_motors() logs the feedforward gains to
+#define FF_SAMPLE_MS 20 // Time between the velocity samples of characterize_motors()
+#define FF_RAMP_RATE 4.f // Motor percent per second the quasistatic test ramps by, slow enough that acceleration is negligible
+#define FF_RAMP_PERCENT 60.f // Motor percent the quasistatic test ramps up to
+#define FF_MIN_VELOCITY 1.f // Wheel speed in inches per second below which quasistatic samples are left out of the fit
+#define FF_STEP_PERCENT 60.f // Motor percent of the step test
+#define FF_STEP_MS 1500 // Duration of the step test, long enough to reach full speed
+#define FF_STEP_TAIL_MS 500 // Final part of the step test whose average speed is taken as the steady state speed
+#define BRAKE_BUCKETS 8 // Number of speed ranges the braking model learns a separate deceleration for
+#define BRAKE_BUCKET_WIDTH 3.f // Width of each speed range of the braking model in inches per second
+#define BRAKE_DEFAULT_DECEL 100.f // Coasting deceleration in inches per second squared assumed until a speed range has been learned
+#define BRAKE_LEARN_SAMPLES 8 // Stops the braking model averages over, later stops replace the oldest ones gradually
+#define BRAKE_VELOCITY_MS 20 // Window over which the wheel speed is measured for the braking model
+#define BRAKE_FILE "braking.txt" // SD card file the learned braking model is kept in between runs
+#define MOTOR_PERCENT_STEP 0.1f // Resolution of motor commands in percent, changes smaller than this are not written to the motors
+#define OUTPUT_UNKNOWN -1000.f // Cached output value that no command matches, so the next write always goes through
+#define NO_COUNT_LIMIT 0x7FFFFFFF // Stop threshold of a wheel whose counts do not end the motion
 
 // Motor ports
 FEHMotor right_motor(FEHMotor::Motor0, 9.0);
@@ -38,171 +116,1725 @@ DigitalEncoder left_encoder(FEHIO::P0_2);
 // ----------- FUNCTIONS -----------
 
 /*
-    Reads the CdS cell sensor and returns the voltage reading
+    Filtered state of the CdS cell, updated by sample_cds() every SENSOR_PERIOD_MS. A sample is the average of CDS_OVERSAMPLE ADC
+    reads, which takes the ADC noise down before anything else sees it. The latest CDS_MEDIAN samples go through a median filter
+    that rejects spikes, and the median through an exponential average that smooths what is left.
+*/
+struct CdsFilter {
+    float samples[CDS_WINDOW]; // Ring buffer of the latest samples in volts
+    int next; // Index in samples the next sample is written to
+    int count; // Number of samples in the ring buffer, up to CDS_WINDOW
+    float value; // Filtered voltage
+    float slope; // Change of the voltage over the ring buffer in volts per second, negative while the cell sees more light
+    float variance; // Variance of the samples in the ring buffer in volts squared, high while the reading is still moving
+    unsigned long taken; // Number of samples taken since startup, tells a new sample from one already seen
+};
+
+CdsFilter cds = { {}, 0, 0, CDS_DARK, 0.f, 0.f, 0 }; // Filtered CdS cell, read it through read_cds_sensor()
+float color_threshold = COLOR_THRESHOLD; // CdS voltage between the red and the blue light, see calibrate_light_thresholds()
+float ticket_light_threshold = TICKET_LIGHT_THRESHOLD; // CdS voltage between ambient light and the dimmer ticket booth light
+
+/*
+    Reads the CdS cell CDS_OVERSAMPLE times and returns the average.
+    PARAMS: N/A
+    RETURN:
+        float voltage - average of the reads in volts
+*/
+float oversample_cds(){
+    float sum = 0;
+    for(int i = 0; i < CDS_OVERSAMPLE; i++){
+        sum += cds_cell.Value();
+    }
+    return(sum / CDS_OVERSAMPLE);
+}
+
+/*
+    Takes one oversampled reading of the CdS cell and runs it through the filters. Called at a fixed rate by sensor_task(), so the
+    slope can count samples instead of reading the clock.
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void sample_cds(){
+    cds.samples[cds.next] = oversample_cds();
+    cds.next = (cds.next + 1) % CDS_WINDOW;
+    cds.taken++;
+    if(cds.count < CDS_WINDOW){
+        cds.count++;
+    }
+
+    // median of the latest samples, sorted by insertion into a scratch copy
+    int n = (cds.count < CDS_MEDIAN) ? cds.count : CDS_MEDIAN;
+    float latest[CDS_MEDIAN] = {};
+    for(int i = 0; i < n; i++){
+        float sample = cds.samples[(cds.next - 1 - i + CDS_WINDOW) % CDS_WINDOW];
+        int j = i;
+        while(j > 0 && latest[j - 1] > sample){
+            latest[j] = latest[j - 1];
+            j--;
+        }
+        latest[j] = sample;
+    }
+    float median = latest[n / 2];
+    cds.value = (cds.count == 1) ? median : cds.value + (median - cds.value) * CDS_FILTER;
+
+    // least squares slope and variance over the ring buffer, oldest sample first
+    float mean = 0;
+    for(int i = 0; i < cds.count; i++){
+        mean += cds.samples[i];
+    }
+    mean /= cds.count;
+    float center = (cds.count - 1) / 2.f;
+    float sum_tx = 0, sum_tt = 0, sum_xx = 0;
+    for(int i = 0; i < cds.count; i++){
+        float sample = cds.samples[(cds.next - cds.count + i + CDS_WINDOW) % CDS_WINDOW] - mean;
+        float t = i - center;
+        sum_tx += t * sample;
+        sum_tt += t * t;
+        sum_xx += sample * sample;
+    }
+    cds.slope = (sum_tt > 0) ? sum_tx / sum_tt * (1000.f / SENSOR_PERIOD_MS) : 0.f;
+    cds.variance = sum_xx / cds.count;
+}
+
+/*
+    Returns the filtered voltage of the CdS cell, see sample_cds(). The cell is sampled in the background by sensor_task(), so
+    this only reads the latest value and the scheduler has to be running for it to change.
     PARAMS: N/A
     RETURN: 
-        float cell_reading - voltage reading of CdS cell 
+        float cell_reading - filtered voltage of the CdS cell
 */
 float read_cds_sensor(){
-    float cell_reading = cds_cell.Value();
+    float cell_reading = cds.value;
     return(cell_reading);
 }
 
 /*
-    Calculates the distance traveled based on the number of counts input.
+    Converts a distance into the number of encoder counts the wheels report after covering it. Motion targets are converted once
+    with this function so the polling loops only compare integers.
+    PARAMS:
+        float distance - distance in inches
+    RETURN: 
+        int counts - encoder counts corresponding to the distance
+*/
+constexpr int distance_to_counts(float distance){
+    // counts = (distance * countsPerRevolution) / (2 * pi * wheelRadius)
+    int counts = (int)(distance * COUNTS_PER_INCH);
+    return(counts);
+}
+
+/*
+    Converts a turn angle into the number of encoder counts each wheel reports while turning in place by that angle.
+    PARAMS:
+        float angle - angle of turn in degrees
+    RETURN: 
+        int counts - encoder counts corresponding to the turn
+*/
+constexpr int angle_to_counts(float angle){
+    // arc length = turnRadius * angle in radians
+    int counts = distance_to_counts(RADIUS_OF_TURN * angle * (PI / 180.f));
+    return(counts);
+}
+
+/*
+    PI controller that keeps both wheels at the same count while driving straight or turning in place. The returned correction is subtracted from the
+    right wheel speed and added to the left wheel speed.
+    PARAMS:
+        int error - right wheel counts minus left wheel counts
+        float *integral - accumulated error in count-seconds, owned by the caller and updated every CONTROL_PERIOD_MS
+    RETURN: 
+        float correction - motor percent to shift from the right wheel to the left wheel
+*/
+float heading_correction(int error, float *integral){
+    *integral += error * (CONTROL_PERIOD_MS / 1000.f);
+
+    // anti-windup, the integral alone never asks for more than the maximum correction
+    float integral_limit = HEADING_MAX_CORRECTION / HEADING_KI;
+    if(*integral > integral_limit){
+        *integral = integral_limit;
+    }
+    else if(*integral < -integral_limit){
+        *integral = -integral_limit;
+    }
+
+    float correction = HEADING_KP * error + HEADING_KI * *integral;
+    if(correction > HEADING_MAX_CORRECTION){
+        correction = HEADING_MAX_CORRECTION;
+    }
+    else if(correction < -HEADING_MAX_CORRECTION){
+        correction = -HEADING_MAX_CORRECTION;
+    }
+    return(correction);
+}
+
+/*
+    Trapezoidal speed profile shared by the motion primitives. Speed ramps up from the entry speed at PROFILE_ACCEL, cruises
+    at the peak speed and ramps back down at PROFILE_DECEL so it reaches the exit speed at the target. Segments too short to
+    reach the peak speed follow a triangular profile instead. Both ends default to PROFILE_START_PERCENT; blended segments enter
+    and exit at the junction speed instead, see junction_percent().
+    PARAMS:
+        int traveled_counts - encoder counts covered since the start of the motion
+        int target_counts - encoder counts at which the motion ends
+        float peak - cruise speed as a motor percentage
+        float entry - motor percentage at the start of the motion
+        float exit - motor percentage at the target
+    RETURN: 
+        float percent - motor percentage to command at this point of the motion
+*/
+float profile_percent(int traveled_counts, int target_counts, float peak, float entry=PROFILE_START_PERCENT, float exit=PROFILE_START_PERCENT){
+    int remaining_counts = target_counts - traveled_counts;
+    if(remaining_counts < 0){
+        remaining_counts = 0;
+    }
+
+    float percent = peak;
+    float accelerating = entry + traveled_counts * (PROFILE_ACCEL / COUNTS_PER_INCH);
+    float decelerating = exit + remaining_counts * (PROFILE_DECEL / COUNTS_PER_INCH);
+    if(accelerating < percent){
+        percent = accelerating;
+    }
+    if(decelerating < percent){
+        percent = decelerating;
+    }
+    return(percent);
+}
+
+// ----------- SCHEDULER -----------
+
+/*
+    A periodic task run by the cooperative scheduler. Tasks must return quickly; anything that takes longer than one period of the
+    fastest task delays every other task and shows up as overruns.
+*/
+struct Task {
+    const char *name; // Name shown in the overrun report
+    void (*run)(); // Function called once per period
+    unsigned long period_ms; // Time between releases in milliseconds
+    unsigned long next_release_ms; // TimeNowMSec() at which the task is due next
+    unsigned long runs; // Number of times the task has run
+    unsigned long overruns; // Number of releases missed because the scheduler got to the task a full period late
+};
+
+Task tasks[MAX_TASKS];
+int task_count = 0;
+
+/*
+    Registers a task with the scheduler. Called from init() before any motion starts.
+    PARAMS:
+        const char *name - name shown in the overrun report
+        void (*run)() - function called once per period
+        unsigned long period_ms - time between calls in milliseconds, 0 to run on every pass of the scheduler
+    RETURN: N/A
+*/
+void add_task(const char *name, void (*run)(), unsigned long period_ms){
+    if(task_count >= MAX_TASKS){
+        return;
+    }
+    Task *task = &tasks[task_count];
+    task->name = name;
+    task->run = run;
+    task->period_ms = period_ms;
+    task->next_release_ms = TimeNowMSec();
+    task->runs = 0;
+    task->overruns = 0;
+    task_count++;
+}
+
+/*
+    Makes one pass over the registered tasks and runs every task whose release time has come, in registration order. A task that
+    is picked up a full period late counts an overrun and is re-aligned to the current time instead of running to catch up.
+    Tasks with a period of 0 run on every pass and never overrun.
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void run_tasks(){
+    for(int i = 0; i < task_count; i++){
+        Task *task = &tasks[i];
+        if(task->period_ms == 0){
+            task->run();
+            task->runs++;
+            continue;
+        }
+        unsigned long now = TimeNowMSec();
+        // signed difference so the comparison survives TimeNowMSec() wrapping around
+        long late_ms = (long)(now - task->next_release_ms);
+        if(late_ms < 0){
+            continue;
+        }
+        if(late_ms >= (long)task->period_ms){
+            task->overruns++;
+            task->next_release_ms = now;
+        }
+        task->next_release_ms += task->period_ms;
+        task->run();
+        task->runs++;
+    }
+}
+
+/*
+    Runs the scheduler until the given condition is met. This replaces the empty busy-wait loops, so sensing and display keep
+    running while a procedure waits.
+    PARAMS:
+        bool (*done)() - condition checked between scheduler passes
+    RETURN: N/A
+*/
+void run_tasks_until(bool (*done)()){
+    while(!done()){
+        run_tasks();
+    }
+}
+
+/*
+    Runs the scheduler for the given amount of time. Used in place of Sleep() everywhere the robot waits.
+    PARAMS:
+        float seconds - time to wait in seconds
+    RETURN: N/A
+*/
+void wait(float seconds){
+    if(seconds <= 0){
+        return;
+    }
+    unsigned long end = TimeNowMSec() + (unsigned long)(seconds * 1000);
+    while((long)(TimeNowMSec() - end) < 0){
+        run_tasks();
+    }
+}
+
+/*
+    Writes the number of runs and overruns of every task to the LCD.
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void report_overruns(){
+    for(int i = 0; i < task_count; i++){
+        LCD.Write(tasks[i].name);
+        LCD.Write(": ");
+        LCD.Write((int)tasks[i].overruns);
+        LCD.Write(" overruns in ");
+        LCD.Write((int)tasks[i].runs);
+        LCD.WriteLine(" runs");
+    }
+}
+
+// ----------- PROCEDURES -----------
+
+float right_percent = OUTPUT_UNKNOWN; // Last percent written to right_motor
+float left_percent = OUTPUT_UNKNOWN; // Last percent written to left_motor
+float servo_degree = OUTPUT_UNKNOWN; // Last angle written to servo_arm
+
+bool right_first = true; // Which drive motor set_drive() writes first the next time both change
+unsigned long drive_started_ms = 0; // TimeNowMSec() of the first drive command that powered a wheel, see report_start()
+float battery_voltage = BATTERY_NOMINAL_VOLTAGE; // Running average of the battery voltage, updated by battery_task()
+float drive_compensation = 1.f; // Factor set_drive() scales the motor percents by so they give the speed they gave at nominal voltage
+
+/*
+    Limits a motor percent to the range the motors accept.
+    PARAMS:
+        float percent - motor percent
+    RETURN:
+        float clamped - percent limited to -100 to 100
+*/
+float clamp_percent(float percent){
+    if(percent > 100.f){
+        return(100.f);
+    }
+    if(percent < -100.f){
+        return(-100.f);
+    }
+    return(percent);
+}
+
+/*
+    Sets both drive motors in one update. The percents are scaled by drive_compensation so a given percent drives the wheels at
+    the same speed on a fresh or a tired battery. They are then rounded to MOTOR_PERCENT_STEP and only motors whose value changed are
+    written, so the controllers can call this every period without flooding the motor driver. Both values are worked out before
+    either motor is written, so the two writes follow each other directly. The motors can only be written one after the other,
+    so when both change the order alternates between updates; that way neither wheel systematically gets a head start and the
+    skew does not build up into a heading bias. Run the simulator with SIM_SKEW=1 to measure it.
+    PARAMS:
+        float right - right motor percent
+        float left - left motor percent
+    RETURN: N/A
+*/
+void set_drive(float right, float left){
+    right = clamp_percent(right * drive_compensation);
+    left = clamp_percent(left * drive_compensation);
+    right = roundf(right / MOTOR_PERCENT_STEP) * MOTOR_PERCENT_STEP;
+    left = roundf(left / MOTOR_PERCENT_STEP) * MOTOR_PERCENT_STEP;
+    bool write_right = (right != right_percent);
+    bool write_left = (left != left_percent);
+    if(write_right && write_left){
+        if(right_first){
+            right_motor.SetPercent(right);
+            left_motor.SetPercent(left);
+        }
+        else {
+            left_motor.SetPercent(left);
+            right_motor.SetPercent(right);
+        }
+        right_first = !right_first;
+    }
+    else if(write_right){
+        right_motor.SetPercent(right);
+    }
+    else if(write_left){
+        left_motor.SetPercent(left);
+    }
+    if(drive_started_ms == 0 && (right != 0 || left != 0)){
+        drive_started_ms = TimeNowMSec();
+    }
+    right_percent = right;
+    left_percent = left;
+}
+
+/*
+    Sets the servo arm angle, skipping the write when the arm was already commanded to that angle.
+    PARAMS:
+        float degree - servo angle in degrees
+    RETURN: N/A
+*/
+void set_servo(float degree){
+    if(degree != servo_degree){
+        servo_arm.SetDegree(degree);
+        servo_degree = degree;
+    }
+}
+
+/*
+    Sets the motor percent for the left and right motors to 0%, stopping the robot. This function will be primarily used as a helper function for other functions.
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void stop_motors(){
+    set_drive(0, 0);
+}
+
+/*
+    Counts of both encoders read together, with the time they were read.
+*/
+struct EncoderSnapshot {
+    int right; // Right encoder counts
+    int left; // Left encoder counts
+    unsigned long ms; // TimeNowMSec() when the counts were read
+};
+
+/*
+    Reads both encoders as one consistent pair. The counters are read twice and the pair is accepted once neither changed in
+    between, so a count that lands between the two reads cannot leave one wheel a tick behind the other. Gives up after
+    ENCODER_SNAPSHOT_TRIES attempts and returns the latest pair, which is what happens if the wheels are spinning fast.
+    PARAMS: N/A
+    RETURN:
+        EncoderSnapshot snapshot - counts of both encoders and the time they were read
+*/
+EncoderSnapshot read_encoders(){
+    EncoderSnapshot snapshot;
+    snapshot.right = right_encoder.Counts();
+    snapshot.left = left_encoder.Counts();
+    snapshot.ms = TimeNowMSec();
+    for(int i = 1; i < ENCODER_SNAPSHOT_TRIES; i++){
+        int right = right_encoder.Counts();
+        int left = left_encoder.Counts();
+        if(right == snapshot.right && left == snapshot.left){
+            break;
+        }
+        snapshot.right = right;
+        snapshot.left = left;
+        snapshot.ms = TimeNowMSec();
+    }
+    return(snapshot);
+}
+
+/*
+    Encoder count thresholds and what to do once one is passed. The Proteus firmware counts encoder edges in its own interrupt
+    handler and offers no hook into it, so the watch is checked by watch_task() on every pass of the scheduler instead. That
+    keeps the stop latency down to one scheduler pass, independent of the period of the motion task.
+*/
+struct EncoderWatch {
+    bool armed; // True while the watch waits for a threshold to be passed
+    int right_limit; // Right encoder counts above which the watch fires, NO_COUNT_LIMIT to ignore the right encoder
+    int left_limit; // Left encoder counts above which the watch fires, NO_COUNT_LIMIT to ignore the left encoder
+    int sum_limit; // Sum of both encoder counts above which the watch fires, NO_COUNT_LIMIT to ignore the sum
+    int turn_sign; // 1 or -1 to fire on rotation_limit towards the left or right, 0 to ignore the difference of the encoders
+    int rotation_limit; // Right minus left encoder counts, times turn_sign, above which the watch fires
+    bool brake; // True to fire early by the distance the robot is predicted to coast, see coast_counts()
+    void (*on_target)(); // Called once when the watch fires, stop_motors() when null
+};
+
+EncoderWatch encoder_watch; // Zero initialized, so nothing is watched at startup
+
+/*
+    Coasting deceleration learned for one range of wheel speeds, and how well the stops at those speeds landed in this run.
+*/
+struct BrakeBucket {
+    float decel; // Coasting deceleration in counts per second squared
+    int samples; // Stops the deceleration was learned from, over all runs, at most BRAKE_LEARN_SAMPLES
+    int stops; // Braked stops in this run
+    float overshoot; // Mean counts the robot came to rest past the target in this run, negative when short
+    int worst; // Counts past the target of the stop that landed furthest from it in this run
+};
+
+/*
+    State of the braked stop in progress, from the motors being cut early until settle() measures where the robot came to rest.
+*/
+struct BrakeState {
+    EncoderSnapshot last; // Counts the wheel speed is measured from
+    float velocity; // Average speed of both wheels in counts per second
+    int lead; // Counts the robot would still coast at that speed, updated with it
+    int target; // Average counts of both wheels the motion should end at
+    int cut_counts; // Average counts when the motors were cut
+    float cut_velocity; // Wheel speed when the motors were cut
+    bool pending; // True from the cut until settle() has measured the stop
+};
+
+BrakeBucket brake_buckets[BRAKE_BUCKETS]; // Braking model, filled in by load_braking()
+BrakeState brake; // Braked stop in progress
+
+/*
+    Speed range of the braking model a wheel speed falls in.
+    PARAMS:
+        float velocity - wheel speed in counts per second
+    RETURN:
+        int bucket - index into brake_buckets
+*/
+int brake_bucket(float velocity){
+    int bucket = (int)(velocity / (BRAKE_BUCKET_WIDTH * COUNTS_PER_INCH));
+    if(bucket < 0){
+        return(0);
+    }
+    if(bucket >= BRAKE_BUCKETS){
+        return(BRAKE_BUCKETS - 1);
+    }
+    return(bucket);
+}
+
+/*
+    Predicts how far the wheels coast after the motors are cut at the given speed, from the deceleration learned for that speed.
+    PARAMS:
+        float velocity - wheel speed in counts per second
+    RETURN:
+        int counts - encoder counts the wheels turn before they stop
+*/
+int coast_counts(float velocity){
+    if(velocity <= 0){
+        return(0);
+    }
+    return((int)(velocity * velocity / (2.f * brake_buckets[brake_bucket(velocity)].decel)));
+}
+
+/*
+    Prepares a braked stop for the motion being started. Call after the encoders were reset.
+    PARAMS:
+        int target - average counts of both wheels the motion should end at
+    RETURN: N/A
+*/
+void arm_braking(int target){
+    brake.last = read_encoders();
+    brake.velocity = 0;
+    brake.lead = 0;
+    brake.target = target;
+    brake.pending = false;
+}
+
+/*
+    Measures where the robot came to rest after a braked stop, adds the stop to the overshoot statistics of its speed range
+    and moves the deceleration of that range towards the one the robot actually showed. Called by settle() once the robot is
+    at rest; does nothing if the last motion did not end in a braked stop.
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void learn_braking(){
+    if(!brake.pending){
+        return;
+    }
+    brake.pending = false;
+    EncoderSnapshot counts = read_encoders();
+    int final_counts = (counts.right + counts.left) / 2;
+    BrakeBucket *bucket = &brake_buckets[brake_bucket(brake.cut_velocity)];
+
+    int overshoot = final_counts - brake.target;
+    bucket->stops++;
+    bucket->overshoot += (overshoot - bucket->overshoot) / bucket->stops;
+    if(abs(overshoot) > abs(bucket->worst)){
+        bucket->worst = overshoot;
+    }
+
+    // a stop that did not coast at all says nothing about the deceleration
+    int coast = final_counts - brake.cut_counts;
+    if(coast > 0 && brake.cut_velocity > 0){
+        if(bucket->samples < BRAKE_LEARN_SAMPLES){
+            bucket->samples++;
+        }
+        float decel = brake.cut_velocity * brake.cut_velocity / (2.f * coast);
+        bucket->decel += (decel - bucket->decel) / bucket->samples;
+    }
+}
+
+/*
+    Arms the encoder watch with new thresholds, replacing any earlier ones. Reset the encoders before arming, the thresholds are
+    compared against the raw counts.
+    PARAMS:
+        EncoderWatch watch - thresholds and callback, armed is ignored
+    RETURN: N/A
+*/
+void arm_encoder_watch(EncoderWatch watch){
+    watch.armed = true;
+    encoder_watch = watch;
+}
+
+/*
+    Disarms the encoder watch without calling its callback.
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void disarm_encoder_watch(){
+    encoder_watch.armed = false;
+}
+
+/*
+    Runs on every pass of the scheduler. Fires the encoder watch once any of its thresholds is passed, or for a braked watch once
+    the robot would coast past one.
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void watch_task(){
+    if(!encoder_watch.armed){
+        return;
+    }
+    EncoderSnapshot counts = read_encoders();
+
+    // a braked watch fires once the point the robot would coast to is past the target, rather than the robot itself
+    int lead = 0;
+    if(encoder_watch.brake){
+        if((long)(counts.ms - brake.last.ms) >= BRAKE_VELOCITY_MS){
+            int moved = (counts.right + counts.left) - (brake.last.right + brake.last.left);
+            brake.velocity = moved * 500.f / (counts.ms - brake.last.ms);
+            brake.last = counts;
+            brake.lead = coast_counts(brake.velocity);
+        }
+        lead = brake.lead;
+    }
+
+    bool passed = counts.right + lead > encoder_watch.right_limit || counts.left + lead > encoder_watch.left_limit
+        || counts.right + counts.left + 2 * lead > encoder_watch.sum_limit
+        || (encoder_watch.turn_sign != 0 && (counts.right - counts.left) * encoder_watch.turn_sign > encoder_watch.rotation_limit);
+    if(!passed){
+        return;
+    }
+    encoder_watch.armed = false;
+    if(encoder_watch.brake){
+        brake.cut_counts = (counts.right + counts.left) / 2;
+        brake.cut_velocity = brake.velocity;
+        brake.pending = true;
+    }
+    if(encoder_watch.on_target){
+        encoder_watch.on_target();
+    }
+    else {
+        stop_motors();
+    }
+}
+
+/*
+    Position and heading of the robot in course coordinates.
+*/
+struct Pose {
+    float x; // Inches
+    float y; // Inches
+    float theta; // Radians, counterclockwise from the x axis
+};
+
+Pose pose = { START_X, START_Y, START_HEADING * (PI / 180.f) }; // Estimated pose, integrated from the encoders by update_pose()
+Pose goal = { START_X, START_Y, START_HEADING * (PI / 180.f) }; // Pose the commanded motions should have reached, see start_motion()
+EncoderSnapshot pose_counts; // Encoder counts already integrated into pose
+int right_sign = 1; // Direction of the right wheel, the encoders only count ticks and do not know which way the wheel turns
+int left_sign = 1; // Direction of the left wheel
+bool goal_from_pose = false; // Set when the last motion had no planned end point, so goal is taken from pose before the next one
+
+/*
+    Wraps an angle into the range -pi to pi.
+    PARAMS:
+        float angle - angle in radians
+    RETURN:
+        float wrapped - the same angle between -pi and pi
+*/
+float wrap_angle(float angle){
+    while(angle > PI){
+        angle -= 2.f * PI;
+    }
+    while(angle < -PI){
+        angle += 2.f * PI;
+    }
+    return(angle);
+}
+
+/*
+    Integrates the encoder counts since the last update into pose. The wheel directions come from right_sign and left_sign, which
+    start_motion() sets, so counts the robot makes while coasting after a stop are still credited to the right direction.
+    Runs from pose_task() every CONTROL_PERIOD_MS and before every encoder reset.
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void update_pose(){
+    EncoderSnapshot counts = read_encoders();
+    float right = (counts.right - pose_counts.right) * right_sign / COUNTS_PER_INCH;
+    float left = (counts.left - pose_counts.left) * left_sign / COUNTS_PER_INCH;
+    pose_counts = counts;
+
+    // midpoint integration, exact for the short arcs covered in one update
+    float distance = (right + left) / 2.f;
+    float rotation = (right - left) / TRACK_WIDTH;
+    float heading = pose.theta + rotation / 2.f;
+    pose.x += distance * cosf(heading);
+    pose.y += distance * sinf(heading);
+    pose.theta = wrap_angle(pose.theta + rotation);
+}
+
+/*
+    Resets the counts for both the left and right motors. Another helper function similar to stop_motors()
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void reset_motor_counts(){
+    // fold in the counts since the last pose update before they are lost
+    update_pose();
+    right_encoder.ResetCounts();
+    left_encoder.ResetCounts();
+    pose_counts.right = 0;
+    pose_counts.left = 0;
+}
+
+/*
+    Writes the estimated pose to the LCD, to compare against where the robot really is at the end of a run.
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void report_pose(){
+    LCD.Write("estimated pose: ");
+    LCD.Write(pose.x);
+    LCD.Write(" ");
+    LCD.Write(pose.y);
+    LCD.Write(" ");
+    LCD.WriteLine(pose.theta * (180.f / PI));
+}
+
+/*
+    Feedforward model of one drive wheel: the motor percent that holds a wheel speed and acceleration is
+    kS * sign(velocity) + kV * velocity + kA * acceleration. Only measured for now: characterize_motors() logs it to the SD card
+    for tuning, and the speed profiles work in motor percent without it.
+*/
+struct Feedforward {
+    float ks; // Percent needed to overcome static friction
+    float kv; // Percent per inch per second of wheel speed
+    float ka; // Percent per inch per second squared of wheel acceleration
+};
+
+// Filled in by characterize_motors()
+Feedforward right_ff = {};
+Feedforward left_ff = {};
+
+/*
+    Stores the feedforward gains on the SD card so they can be read off the card after characterize_motors().
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void store_feedforward(){
+    FEHFile *file = SD.FOpen(FF_FILE, "w");
+    if(file == NULL){
+        return;
+    }
+    SD.FPrintf(file, "%f %f %f %f %f %f\n", right_ff.ks, right_ff.kv, right_ff.ka, left_ff.ks, left_ff.kv, left_ff.ka);
+    SD.FClose(file);
+}
+
+/*
+    Loads the light thresholds calibrate_light_thresholds() stored on the SD card. Keeps COLOR_THRESHOLD and
+    TICKET_LIGHT_THRESHOLD if the file is missing or cannot be read.
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void load_light_thresholds(){
+    FEHFile *file = SD.FOpen(THRESHOLD_FILE, "r");
+    if(file == NULL){
+        return;
+    }
+    float color, ticket;
+    if(SD.FScanf(file, "%f %f", &color, &ticket) == 2){
+        color_threshold = color;
+        ticket_light_threshold = ticket;
+    }
+    SD.FClose(file);
+}
+
+/*
+    Stores the light thresholds on the SD card, see load_light_thresholds().
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void store_light_thresholds(){
+    FEHFile *file = SD.FOpen(THRESHOLD_FILE, "w");
+    if(file == NULL){
+        return;
+    }
+    SD.FPrintf(file, "%f %f\n", color_threshold, ticket_light_threshold);
+    SD.FClose(file);
+}
+
+/*
+    Loads the braking model learned in earlier runs from the SD card. Speed ranges the file does not cover start from
+    BRAKE_DEFAULT_DECEL.
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void load_braking(){
+    for(int i = 0; i < BRAKE_BUCKETS; i++){
+        brake_buckets[i].decel = BRAKE_DEFAULT_DECEL * COUNTS_PER_INCH;
+        brake_buckets[i].samples = 0;
+    }
+    FEHFile *file = SD.FOpen(BRAKE_FILE, "r");
+    if(file == NULL){
+        return;
+    }
+    for(int i = 0; i < BRAKE_BUCKETS; i++){
+        float decel;
+        int samples;
+        if(SD.FScanf(file, "%f %d", &decel, &samples) != 2 || decel <= 0){
+            break;
+        }
+        brake_buckets[i].decel = decel;
+        brake_buckets[i].samples = samples;
+    }
+    SD.FClose(file);
+}
+
+/*
+    Stores the braking model on the SD card so the next run starts from what this one learned, see load_braking().
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void store_braking(){
+    FEHFile *file = SD.FOpen(BRAKE_FILE, "w");
+    if(file == NULL){
+        return;
+    }
+    for(int i = 0; i < BRAKE_BUCKETS; i++){
+        SD.FPrintf(file, "%f %d\n", brake_buckets[i].decel, brake_buckets[i].samples);
+    }
+    SD.FClose(file);
+}
+
+/*
+    Writes the overshoot statistics and learned deceleration of every speed range that saw a braked stop this run to the LCD.
+    Distances are in inches.
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void report_braking(){
+    for(int i = 0; i < BRAKE_BUCKETS; i++){
+        BrakeBucket *bucket = &brake_buckets[i];
+        if(bucket->stops == 0){
+            continue;
+        }
+        LCD.Write((int)(i * BRAKE_BUCKET_WIDTH));
+        LCD.Write("-");
+        LCD.Write((int)((i + 1) * BRAKE_BUCKET_WIDTH));
+        LCD.Write(" in/s: ");
+        LCD.Write(bucket->stops);
+        LCD.Write(" stops, overshoot ");
+        LCD.Write(bucket->overshoot / COUNTS_PER_INCH);
+        LCD.Write(" worst ");
+        LCD.Write(bucket->worst / COUNTS_PER_INCH);
+        LCD.Write(" decel ");
+        LCD.WriteLine(bucket->decel / COUNTS_PER_INCH);
+    }
+}
+
+// ----------- TASKS -----------
+
+// Motion types handled by motion_task()
+#define MOTION_IDLE 0 // No motion in progress
+#define MOTION_MOVE 1 // Straight segment, see move()
+#define MOTION_TURN 2 // Turn in place, see turn()
+#define MOTION_FAILSAFE 3 // Straight segment with a time limit, see move_failsafe()
+#define MOTION_TO_LIGHT 4 // Straight segment until the CdS cell sees a light, see move_to_light()
+#define MOTION_ARC 5 // Constant curvature segment, see arc()
+
+/*
+    State of the motion in progress. Set up by start_motion() and advanced by motion_task().
+*/
+struct Motion {
+    int type; // One of the MOTION_ values
+    int direction; // 1 or -1; for turns this is the direction of the right wheel
+    float speed; // Peak motor speed as a percentage
+    int target_counts; // Encoder counts at which the motion ends
+    bool has_deadline; // True when the motion gives up at deadline_ms
+    unsigned long deadline_ms; // TimeNowMSec() at which a MOTION_FAILSAFE motion gives up
+    unsigned long next_update_ms; // TimeNowMSec() at which the motor outputs are recomputed next
+    float integral; // Integral term of heading_correction()
+    float entry_percent; // Motor percent the speed profile starts from
+    float exit_percent; // Motor percent the speed profile ends at
+    int heading_offset; // Right minus left wheel counts the heading controller steers towards to bring the heading back to goal
+    float right_scale; // Right wheel speed relative to the center of the robot, 1 on straight segments
+    float left_scale; // Left wheel speed relative to the center of the robot, 1 on straight segments
+    bool blend_out; // True when the motors keep running at the end of the motion because the next segment continues from it
+    EncoderSnapshot last; // Counts at the previous update of the outputs, for the speed of a MOTION_TO_LIGHT
+    float velocity; // Speed of a MOTION_TO_LIGHT in inches per second
+    int light_counts; // Average counts at which a MOTION_TO_LIGHT crossed ticket_light_threshold, -1 before it has
+    unsigned int id; // Sequence number of the motion, matched against MotionHandle::id
+};
+
+Motion motion; // Zero initialized, so no motion is in progress at startup
+unsigned int motions_started = 0; // Number of motions started so far, used to hand out motion ids
+const char *status = ""; // Course phase shown by display_task(), set with set_status()
+const char *displayed_status = ""; // Course phase currently on the LCD
+
+/*
+    Refers to a motion started by one of the _async procedures. The drivetrain runs one motion at a time, so a handle also reports
+    done once a later motion has replaced its motion. Servo commands and set_status() are safe to issue while the motion runs;
+    writing to the LCD directly stalls the motion task for as long as the write takes.
+*/
+struct MotionHandle {
+    unsigned int id; // Sequence number of the motion this handle refers to
+
+    /*
+        Checks whether the motion has finished, been cancelled or been replaced by a later motion.
+        PARAMS: N/A
+        RETURN:
+            bool done - true when the motion no longer drives the motors
+    */
+    bool is_done(){
+        return(motion.type == MOTION_IDLE || motion.id != id);
+    }
+
+    /*
+        Runs the scheduler until the motion is done.
+        PARAMS: N/A
+        RETURN: N/A
+    */
+    void wait(){
+        while(!is_done()){
+            run_tasks();
+        }
+    }
+
+    /*
+        Stops the motors if the motion is still in progress. Does nothing once the motion is done. The planned end point was
+        never reached, so the next motion takes goal from wherever the robot stopped.
+        PARAMS: N/A
+        RETURN: N/A
+    */
+    void cancel(){
+        if(!is_done()){
+            disarm_encoder_watch();
+            stop_motors();
+            motion.type = MOTION_IDLE;
+            goal_from_pose = true;
+        }
+    }
+};
+
+/*
+    Ends the motion in progress. Stops the motors unless the next segment continues from this one. Called by the encoder watch
+    when the motion reaches its target, and by motion_task() on a deadline or light.
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void end_motion(){
+    disarm_encoder_watch();
+    if(!motion.blend_out){
+        stop_motors();
+    }
+    motion.type = MOTION_IDLE;
+}
+
+/*
+    Brings pose up to date and, when the last motion had no planned end point, takes goal from it. Segments that end on a wall or
+    a light stop wherever the wall or light is, so the pose they reached becomes the plan.
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void sync_goal(){
+    update_pose();
+    if(goal_from_pose){
+        goal = pose;
+        goal_from_pose = false;
+    }
+}
+
+/*
+    Begins a motion and returns immediately; motion_task() drives it to completion. A motion already in progress is replaced.
+    PARAMS:
+        int type - one of the MOTION_ values
+        int target_counts - encoder counts at which the motion ends
+        int direction - 1 or -1; for turns this is the direction of the right wheel
+        float speed - peak motor speed as a percentage
+        unsigned long timeout_ms - time limit for MOTION_FAILSAFE motions in milliseconds
+        float entry_percent - motor percent a profiled motion starts from
+        float exit_percent - motor percent a profiled motion ends at
+        bool blend_out - true to leave the motors running at the end so the next segment continues without a stop
+        float radius - turning radius of a MOTION_ARC in inches, positive to the left and negative to the right
+    RETURN:
+        MotionHandle handle - handle to check on, wait for or cancel the motion
+*/
+MotionHandle start_motion(int type, int target_counts, int direction, float speed, unsigned long timeout_ms,
+        float entry_percent=PROFILE_START_PERCENT, float exit_percent=PROFILE_START_PERCENT, bool blend_out=false, float radius=0.f){
+    sync_goal();
+    brake.pending = false;
+
+    // planned motions are corrected for the error the pose estimate shows against the plan, then the plan is advanced by
+    // the motion as commanded
+    int heading_offset = 0;
+    float heading_error = wrap_angle(goal.theta - pose.theta);
+    if(type == MOTION_MOVE){
+        float distance = target_counts / COUNTS_PER_INCH;
+        float along_error = (goal.x - pose.x) * cosf(goal.theta) + (goal.y - pose.y) * sinf(goal.theta);
+        target_counts += (int)(direction * along_error * COUNTS_PER_INCH);
+        heading_offset = (int)(direction * heading_error * TRACK_WIDTH * COUNTS_PER_INCH);
+        goal.x += direction * distance * cosf(goal.theta);
+        goal.y += direction * distance * sinf(goal.theta);
+    }
+    else if(type == MOTION_TURN){
+        float angle = direction * target_counts / (COUNTS_PER_INCH * RADIUS_OF_TURN);
+        goal.theta = wrap_angle(goal.theta + angle);
+        // only the error is wrapped, the turn itself may be any size; a correction that outweighs a small turn reverses it
+        target_counts = (int)(direction * (heading_error + angle) * RADIUS_OF_TURN * COUNTS_PER_INCH);
+        if(target_counts < 0){
+            target_counts = -target_counts;
+            direction = -direction;
+        }
+    }
+    else if(type == MOTION_ARC){
+        // a radius below RADIUS_OF_TURN would reverse the inner wheel and 0 would divide by zero below, so tighter arcs are
+        // widened to RADIUS_OF_TURN with the same change of heading
+        if(fabsf(radius) < RADIUS_OF_TURN){
+            float widened = (radius < 0) ? -RADIUS_OF_TURN : RADIUS_OF_TURN;
+            target_counts = (int)(target_counts * (fabsf(radius) > 0 ? widened / radius : 0.f));
+            radius = widened;
+        }
+        // arcs are driven as planned, the segment after them corrects whatever error they leave
+        float angle = target_counts / (COUNTS_PER_INCH * radius);
+        float heading = wrap_angle(goal.theta + angle);
+        goal.x += radius * (sinf(heading) - sinf(goal.theta));
+        goal.y -= radius * (cosf(heading) - cosf(goal.theta));
+        goal.theta = heading;
+    }
+    else {
+        goal_from_pose = true;
+    }
+    if(target_counts < 0){
+        target_counts = 0;
+    }
+
+    motion.direction = direction;
+    motion.speed = speed;
+    motion.target_counts = target_counts;
+    motion.integral = 0;
+    motion.entry_percent = entry_percent;
+    motion.exit_percent = exit_percent;
+    motion.heading_offset = heading_offset;
+    motion.blend_out = blend_out;
+    motion.velocity = 0;
+    motion.light_counts = -1;
+    motion.right_scale = 1.f;
+    motion.left_scale = 1.f;
+    if(type == MOTION_ARC){
+        motion.right_scale = (radius + RADIUS_OF_TURN) / radius;
+        motion.left_scale = (radius - RADIUS_OF_TURN) / radius;
+    }
+
+    // the encoder part of the stop condition is reduced to count thresholds for the encoder watch; turns end on the average of
+    // both wheels so slip on either wheel is accounted for
+    bool straight = (type == MOTION_MOVE || type == MOTION_FAILSAFE);
+    EncoderWatch watch;
+    watch.right_limit = straight ? target_counts : NO_COUNT_LIMIT;
+    watch.left_limit = straight ? target_counts : NO_COUNT_LIMIT;
+    watch.sum_limit = (type == MOTION_TURN) ? 2 * target_counts : NO_COUNT_LIMIT;
+    // arcs end on the change of heading; the inner wheel lags whenever the curvature changes, which would cut the turn short if
+    // the arc ended on distance
+    watch.turn_sign = 0;
+    watch.rotation_limit = 0;
+    if(type == MOTION_ARC){
+        watch.turn_sign = (radius > 0) ? 1 : -1;
+        watch.rotation_limit = (int)(target_counts * TRACK_WIDTH / (radius * watch.turn_sign));
+    }
+    // profiled motions that come to a stop cut the motors early enough to coast onto the target
+    watch.brake = (type == MOTION_MOVE || type == MOTION_TURN) && !blend_out;
+    watch.on_target = end_motion;
+    motion.has_deadline = (type == MOTION_FAILSAFE);
+
+    // profiled motions start at the bottom of the ramp, the others at their full speed
+    float percent = speed;
+    if(type == MOTION_MOVE || type == MOTION_TURN || type == MOTION_ARC || type == MOTION_TO_LIGHT){
+        percent = profile_percent(0, target_counts, speed, entry_percent, exit_percent);
+    }
+    set_drive(percent * motion.right_scale * direction, (type == MOTION_TURN ? -percent : percent * motion.left_scale) * direction);
+
+    reset_motor_counts();
+    motion.last = read_encoders();
+    right_sign = direction;
+    left_sign = (type == MOTION_TURN) ? -direction : direction;
+    if(watch.brake){
+        arm_braking(target_counts);
+    }
+    if(type != MOTION_TO_LIGHT){
+        arm_encoder_watch(watch);
+    }
+
+    unsigned long now = TimeNowMSec();
+    motion.deadline_ms = now + timeout_ms;
+    motion.next_update_ms = now + CONTROL_PERIOD_MS;
+    motion.type = type;
+    motion.id = ++motions_started;
+
+    MotionHandle handle = { motion.id };
+    return(handle);
+}
+
+/*
+    Adds a turn to the plan without turning in place. The next MOTION_MOVE sees the turn as heading error and steers it in while
+    it drives, which is how blended segments take small turns.
+    PARAMS:
+        int turn_counts - encoder counts of the turn, as passed to start_motion()
+        int direction - direction of the right wheel for the turn, 1 for left and -1 for right
+    RETURN: N/A
+*/
+void plan_turn(int turn_counts, int direction){
+    goal.theta = wrap_angle(goal.theta + direction * turn_counts / (COUNTS_PER_INCH * RADIUS_OF_TURN));
+}
+
+/*
+    Returns true once the motion started by start_motion() has finished.
+    PARAMS: N/A
+    RETURN:
+        bool idle - true when no motion is in progress
+*/
+bool motion_idle(){
+    return(motion.type == MOTION_IDLE);
+}
+
+/*
+    Runs every MOTION_PERIOD_MS. Checks the deadline and the light of the motion in progress on every run, and updates the speed
+    profile and heading controller every CONTROL_PERIOD_MS. The encoder targets are left to the encoder watch armed by
+    start_motion().
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void motion_task(){
+    if(motion.type == MOTION_IDLE){
+        return;
+    }
+
+    EncoderSnapshot counts = read_encoders();
+
+    bool done = motion.has_deadline && (long)(counts.ms - motion.deadline_ms) >= 0;
+    if(motion.type == MOTION_TO_LIGHT && motion.light_counts < 0 && read_cds_sensor() <= ticket_light_threshold){
+        motion.light_counts = (counts.right + counts.left) / 2;
+    }
+    if(done){
+        end_motion();
+        return;
+    }
+
+    if((long)(counts.ms - motion.next_update_ms) < 0){
+        return;
+    }
+    motion.next_update_ms = counts.ms + CONTROL_PERIOD_MS;
+    if(motion.type == MOTION_MOVE || motion.type == MOTION_ARC){
+        // on an arc the wheels keep the ratio of their scales, on a straight segment that is simply equal counts
+        float percent = profile_percent((counts.right + counts.left) / 2, motion.target_counts, motion.speed, motion.entry_percent,
+            motion.exit_percent);
+        int error = (int)(counts.right * motion.left_scale - counts.left * motion.right_scale);
+        float correction = heading_correction(error - motion.heading_offset, &motion.integral);
+        // the encoders cannot tell a wheel running backward from one running forward, so neither wheel is allowed to reverse
+        float right = percent * motion.right_scale - correction;
+        float left = percent * motion.left_scale + correction;
+        set_drive((right > 0 ? right : 0) * motion.direction, (left > 0 ? left : 0) * motion.direction);
+    }
+    else if(motion.type == MOTION_TURN){
+        // both wheels should cover the same counts in opposite directions, the same controller as for straight segments
+        // slows whichever wheel is ahead so they finish together
+        float percent = profile_percent((counts.right + counts.left) / 2, motion.target_counts, motion.speed, motion.entry_percent,
+            motion.exit_percent);
+        float correction = heading_correction(counts.right - counts.left, &motion.integral);
+        set_drive((percent - correction) * motion.direction, -(percent + correction) * motion.direction);
+    }
+    else if(motion.type == MOTION_TO_LIGHT){
+        int traveled = (counts.right + counts.left) / 2;
+        float velocity = ((counts.right + counts.left) - (motion.last.right + motion.last.left)) * 500.f
+            / ((counts.ms - motion.last.ms) * COUNTS_PER_INCH);
+        motion.velocity += (velocity - motion.velocity) * 0.5f;
+        motion.last = counts;
+
+        if(motion.light_counts >= 0){
+            // past the threshold the robot crawls on until the reading stops falling, which is where the cell is right over the
+            // light and the color reads clearest
+            if(cds.slope > -LIGHT_MIN_SLOPE || traveled - motion.light_counts > distance_to_counts(LIGHT_MAX_OVERRUN)){
+                end_motion();
+                return;
+            }
+            set_drive(PROFILE_START_PERCENT * motion.direction, PROFILE_START_PERCENT * motion.direction);
+            return;
+        }
+
+        // ramp up like a profiled segment, then slow down by the distance the falling reading predicts to the threshold
+        float percent = profile_percent(traveled, NO_COUNT_LIMIT, motion.speed, motion.entry_percent, motion.exit_percent);
+        if(cds.slope < -LIGHT_MIN_SLOPE){
+            float seconds = (read_cds_sensor() - ticket_light_threshold) / -cds.slope;
+            // never below the crawl the robot finishes the approach at, a bad speed estimate must not stall or reverse it
+            float slowdown = PROFILE_START_PERCENT + LIGHT_DECEL * motion.velocity * seconds;
+            if(slowdown < PROFILE_START_PERCENT){
+                slowdown = PROFILE_START_PERCENT;
+            }
+            if(slowdown < percent){
+                percent = slowdown;
+            }
+        }
+        set_drive(percent * motion.direction, percent * motion.direction);
+    }
+}
+
+/*
+    Runs every CONTROL_PERIOD_MS and keeps pose up to date, including while the robot coasts after a motion.
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void pose_task(){
+    update_pose();
+}
+
+/*
+    Runs every BATTERY_PERIOD_MS. Averages the battery voltage and updates the factor set_drive() scales the motors by. The
+    voltage is read under load, which is the voltage the motors actually get.
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void battery_task(){
+    battery_voltage += (Battery.Voltage() - battery_voltage) * BATTERY_FILTER;
+    float compensation = BATTERY_NOMINAL_VOLTAGE / battery_voltage;
+    if(compensation < MIN_COMPENSATION){
+        compensation = MIN_COMPENSATION;
+    }
+    else if(compensation > MAX_COMPENSATION){
+        compensation = MAX_COMPENSATION;
+    }
+    drive_compensation = compensation;
+}
+
+/*
+    Runs every SENSOR_PERIOD_MS and samples the CdS cell, see sample_cds().
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void sensor_task(){
+    sample_cds();
+}
+
+/*
+    Runs every DISPLAY_PERIOD_MS and shows the current course phase in the bottom row of the LCD. Writing to the LCD takes
+    milliseconds, so the row is only redrawn when the phase changed and no motion is in progress.
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void display_task(){
+    if(status == displayed_status || !motion_idle()){
+        return;
+    }
+    displayed_status = status;
+    LCD.WriteRC(status, 13, 0);
+}
+
+/*
+    Sets the course phase shown by display_task().
+    PARAMS:
+        const char *phase - text to show, must stay valid for the rest of the run
+    RETURN: N/A
+*/
+void set_status(const char *phase){
+    status = phase;
+}
+
+/*
+    State of the start light detector. The detector samples the CdS cell itself every START_SAMPLE_MS rather than waiting on the
+    filters of sensor_task(), whose median alone holds a change back by two samples.
+*/
+struct StartDetector {
+    float baseline; // Ambient CdS voltage with the start light off, learned by learn_start_baseline() and followed while waiting
+    float noise; // Standard deviation of the ambient samples in volts, follows the CdS filter variance while waiting
+    unsigned long noise_taken; // cds.taken of the filter sample the noise last followed
+    unsigned long next_sample_ms; // TimeNowMSec() at which the next sample is due
+    int confirmed; // Consecutive samples the drop has held for
+    unsigned long onset_ms; // Time of the first sample of the drop that started the run
+    unsigned long next_touch_ms; // TimeNowMSec() at which the screen is next checked for a touch
+    bool touched; // True when a touch ended the wait instead of the start light, see start_light_or_touch()
+};
+
+StartDetector start_detector; // Start light detector, see start_light_on()
+
+/*
+    Learns the ambient light at the start position, with the start light still off. Samples the CdS cell for START_BASELINE_MS
+    while the scheduler runs. A baseline at START_LIGHT_THRESHOLD or below means a brightly lit room, or the start light or
+    something else shining on the cell during init(); the LCD warns that the detector falls back to the absolute threshold, and
+    may start at once, so the robot can be re-placed.
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void learn_start_baseline(){
+    float mean = 0, squares = 0;
+    int samples = 0;
+    unsigned long start_ms = TimeNowMSec();
+    while((long)(TimeNowMSec() - start_ms) < START_BASELINE_MS){
+        float sample = oversample_cds();
+        samples++;
+        float delta = sample - mean;
+        mean += delta / samples;
+        squares += delta * (sample - mean);
+        wait(START_SAMPLE_MS / 1000.f);
+    }
+    start_detector.baseline = mean;
+    start_detector.noise = (samples > 1) ? sqrtf(squares / (samples - 1)) : 0.f;
+    start_detector.noise_taken = cds.taken;
+    start_detector.confirmed = 0;
+    if(start_detector.baseline <= START_LIGHT_THRESHOLD){
+        LCD.WriteLine("WARNING: CDS CELL SEES BRIGHT LIGHT");
+        LCD.WriteLine("MAY START WITHOUT THE START LIGHT");
+    }
+}
+
+/*
+    Returns true once the start light is on. Used with run_tasks_until() at the start of the run. The light counts as on once the
+    reading has dropped from the ambient baseline by START_LIGHT_DROP, or by START_NOISE_SIGMAS of the ambient noise if that is
+    more, for START_CONFIRM_SAMPLES samples in a row. A sample between the drop and START_LIGHT_RELEASE neither confirms nor resets
+    the count, so a reading hovering at the threshold cannot start the run on noise or keep it from starting. While no drop is
+    under way the baseline follows the samples and the noise follows the variance of the CdS filter over START_TRACK_MS, so a
+    room that changes after init(), or a start light that was already on during it, moves the threshold with it.
+    A baseline at START_LIGHT_THRESHOLD or below, or one so noisy that the drop would have to pass START_MAX_DROP, cannot be
+    trusted; the detector then falls back to counting the light as on at START_LIGHT_THRESHOLD, with the same hysteresis.
+    PARAMS: N/A
+    RETURN:
+        bool on - true when the CdS cell sees the start light
+*/
+bool start_light_on(){
+    StartDetector *detector = &start_detector;
+    unsigned long now = TimeNowMSec();
+    if((long)(now - detector->next_sample_ms) < 0){
+        return(false);
+    }
+    detector->next_sample_ms = now + START_SAMPLE_MS;
+
+    // a bright, zero or noisy baseline is measured against the voltage START_LIGHT_DROP above the absolute threshold instead
+    float reference = detector->baseline;
+    float on_drop = START_LIGHT_DROP;
+    if(reference > START_LIGHT_THRESHOLD){
+        on_drop = START_NOISE_SIGMAS * detector->noise / reference;
+        if(on_drop < START_LIGHT_DROP){
+            on_drop = START_LIGHT_DROP;
+        }
+    }
+    if(reference <= START_LIGHT_THRESHOLD || on_drop > START_MAX_DROP){
+        reference = START_LIGHT_THRESHOLD / (1.f - START_LIGHT_DROP);
+        on_drop = START_LIGHT_DROP;
+    }
+    float sample = oversample_cds();
+    float drop = (reference - sample) / reference;
+    if(drop >= on_drop){
+        if(detector->confirmed == 0){
+            detector->onset_ms = now;
+        }
+        detector->confirmed++;
+    }
+    else if(drop < START_LIGHT_RELEASE){
+        detector->confirmed = 0;
+    }
+    if(detector->confirmed == 0){
+        detector->baseline += (sample - detector->baseline) * ((float)START_SAMPLE_MS / START_TRACK_MS);
+    }
+    if(detector->confirmed == 0 && cds.taken != detector->noise_taken){
+        detector->noise += (sqrtf(cds.variance) - detector->noise) * ((float)SENSOR_PERIOD_MS / START_TRACK_MS);
+        detector->noise_taken = cds.taken;
+    }
+    if(detector->confirmed < START_CONFIRM_SAMPLES){
+        return(false);
+    }
+    drive_started_ms = 0;
+    return(true);
+}
+
+/*
+    Returns true once the start light is on or the screen is touched. Used with run_tasks_until() while the robot waits at the
+    start, so a touch can ask for calibrate_light_thresholds() without building a calibration program. The screen is only
+    checked every START_TOUCH_MS so the start light samples stay on time.
+    PARAMS: N/A
+    RETURN:
+        bool done - true when the start light is on or the screen was touched, see StartDetector::touched
+*/
+bool start_light_or_touch(){
+    StartDetector *detector = &start_detector;
+    unsigned long now = TimeNowMSec();
+    if((long)(now - detector->next_touch_ms) >= 0){
+        detector->next_touch_ms = now + START_TOUCH_MS;
+        int x, y;
+        detector->touched = LCD.Touch(&x, &y);
+        if(detector->touched){
+            return(true);
+        }
+    }
+    return(start_light_on());
+}
+
+/*
+    Writes the ambient baseline and the reaction time of the robot to the LCD. The reaction time runs from the first sample
+    that saw the start light to the first drive command of the mission; the light came on up to START_SAMPLE_MS before that
+    sample.
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void report_start(){
+    LCD.Write("start: baseline ");
+    LCD.Write(start_detector.baseline);
+    LCD.Write(" V, reacted in ");
+    LCD.Write((int)(drive_started_ms - start_detector.onset_ms));
+    LCD.WriteLine(" ms");
+}
+
+// ----------- COURSE PROCEDURES -----------
+
+/*
+    Runs the scheduler until the robot has come to rest after the motors stopped. The robot counts as at rest once neither
+    encoder has moved for SETTLE_WINDOW_MS; if it keeps creeping, settle() gives up after SETTLE_TIMEOUT_MS. A braked stop is
+    measured once the robot is at rest, see learn_braking().
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void settle(){
+    EncoderSnapshot last = read_encoders();
+    unsigned long start_ms = last.ms;
+    unsigned long still_since_ms = last.ms;
+    while((long)(last.ms - start_ms) < SETTLE_TIMEOUT_MS){
+        run_tasks();
+        EncoderSnapshot counts = read_encoders();
+        if(counts.ms == last.ms){
+            continue;
+        }
+        if(counts.right != last.right || counts.left != last.left){
+            still_since_ms = counts.ms;
+        }
+        else if((long)(counts.ms - still_since_ms) >= SETTLE_WINDOW_MS){
+            break;
+        }
+        last = counts;
+    }
+    learn_braking();
+}
+
+/*
+    Waits for a motion to finish and for the robot to come to rest before the next primitive, see settle().
+    PARAMS:
+        MotionHandle handle - motion to wait for
+    RETURN: N/A
+*/
+void finish_motion(MotionHandle handle){
+    handle.wait();
+    settle();
+}
+
+/*
+    Starts turning in place by the specified angle and returns immediately. The speed follows profile_percent() so the wheels do
+    not slip when the turn starts and the robot does not overshoot when it stops. The turn is measured on the average of both
+    wheels, and heading_correction() keeps the wheels level so they finish together.
+    PARAMS:
+        float angle - angle of turn in degrees 
+        int direction - direction of turn; left corresponds to direction = 0, right corresponds to direction = 1
+        float speed - peak motor speed as a percentage
+    RETURN:
+        MotionHandle handle - handle to check on, wait for or cancel the turn
+*/
+MotionHandle turn_async(float angle, int direction, float speed=TURN_SPEED){
+    // the right wheel drives forward for a left turn and backward for a right turn
+    int right_direction = (direction == 0) ? 1 : -1;
+    return(start_motion(MOTION_TURN, angle_to_counts(angle), right_direction, speed, 0));
+}
+
+/*
+    Sets the proper motor speed to enable turning for the specified angle and waits for the turn to finish, see turn_async().
+    PARAMS:
+        float angle - angle of turn in degrees 
+        int direction - direction of turn; left corresponds to direction = 0, right corresponds to direction = 1
+        float speed - peak motor speed as a percentage
+    RETURN: N/A
+*/
+void turn(float angle, int direction, float speed=TURN_SPEED){
+    finish_motion(turn_async(angle, direction, speed));
+}
+
+/*
+    Starts moving forward or in reverse and returns immediately. The speed follows profile_percent() and the wheel speeds are
+    balanced with heading_correction() so the robot holds its heading over long segments.
+    PARAMS:
+        float distance - total distance of motion in inches
+        int direction - direction of motion, forward by default, but reverse if -1 is specified for direction
+        float speed - peak motor speed as a percentage
+    RETURN:
+        MotionHandle handle - handle to check on, wait for or cancel the move
+*/
+MotionHandle move_async(float distance, int direction=1, float speed=40.){
+    return(start_motion(MOTION_MOVE, distance_to_counts(distance), direction, speed, 0));
+}
+
+/*
+    Sets the proper motor speed to move forward or in reverse depending on the value of direction and waits for the move to
+    finish, see move_async().
+    PARAMS:
+        float distance - total distance of motion in inches
+        int direction - direction of motion, forward by default, but reverse if -1 is specified for direction
+        float speed - peak motor speed as a percentage
+    RETURN: N/A
+*/
+void move(float distance, int direction=1, float speed=40.){
+    finish_motion(move_async(distance, direction, speed));
+}
+
+/*
+    Starts driving forward along an arc and returns immediately. The center of the robot follows a circle of the given radius while
+    the heading changes by the given angle, so a turn followed by a straight segment can be driven as one smooth motion. The
+    radius must be at least RADIUS_OF_TURN so the inner wheel never reverses; smaller radii are widened to RADIUS_OF_TURN.
+    PARAMS:
+        float radius - radius of the path of the center of the robot in inches
+        float angle - change of heading in degrees
+        int direction - direction of turn; left corresponds to direction = 0, right corresponds to direction = 1
+        float speed - peak speed of the center of the robot as a motor percentage, the outer wheel runs faster
+    RETURN:
+        MotionHandle handle - handle to check on, wait for or cancel the arc
+*/
+MotionHandle arc_async(float radius, float angle, int direction, float speed=40.){
+    if(radius < RADIUS_OF_TURN){
+        radius = RADIUS_OF_TURN;
+    }
+    float signed_radius = (direction == LEFT) ? radius : -radius;
+    return(start_motion(MOTION_ARC, distance_to_counts(radius * angle * (PI / 180.f)), FORWARD, speed, 0, PROFILE_START_PERCENT,
+        PROFILE_START_PERCENT, false, signed_radius));
+}
+
+/*
+    Drives along an arc and waits for it to finish, see arc_async().
     PARAMS:
-        int counts - motor counts
-    RETURN: 
-        float distance - distance traveled in inches 
+        float radius - radius of the path of the center of the robot in inches
+        float angle - change of heading in degrees
+        int direction - direction of turn; left corresponds to direction = 0, right corresponds to direction = 1
+        float speed - peak speed of the center of the robot as a motor percentage, the outer wheel runs faster
+    RETURN: N/A
 */
-float calculate_distance(int counts){
-    // s = (2 * pi * wheelRadius * counts) / countsPerRevolution
-    float distance = (2 * M_PI * 1.5 * counts) / COUNTS_PER_REVOLUTION;
-    return(distance);
-} 
+void arc(float radius, float angle, int direction, float speed=40.){
+    finish_motion(arc_async(radius, angle, direction, speed));
+}
 
 /*
-    Converts degrees to radians
+    Same as move(), but gives up after failsafe_duration seconds. Used to drive into walls to square up, so the wheel speeds are
+    intentionally not balanced.
     PARAMS:
-        float degrees - degrees
-    RETURN: 
-        float rads - radians
+        float distance - total distance of motion in inches
+        float failsafe_duration - maximum time of motion in seconds
+        int direction - direction of motion, forward by default, but reverse if -1 is specified for direction
+        float speed - motor speed as a percentage
+    RETURN: N/A
 */
-float deg_to_rads(float degrees){
-    float rads = degrees * (M_PI / 180.0);
-    return(rads);
+void move_failsafe(float distance, float failsafe_duration, int direction=1, float speed=40.){
+    finish_motion(start_motion(MOTION_FAILSAFE, distance_to_counts(distance), direction, speed, (unsigned long)(failsafe_duration * 1000)));
 }
 
-// ----------- PROCEDURES -----------
-
 /*
-    Sets the motor percent for the left and right motors to 0%, stopping the robot. This function will be primarily used as a helper function for other functions.
-    PARAMS: N/A
+    Modified move() to stop when ticket booth light is reached. The robot ramps up to the given speed and, once the CdS reading
+    starts falling, predicts from its slope how soon the reading crosses ticket_light_threshold and slows down ahead of it. Past
+    the threshold it crawls on and stops where the reading bottoms out, over the light.
+    PARAMS:
+        int direction - direction of motion, forward by default, but reverse if -1 is specified for direction
+        float speed - peak motor speed as a percentage
     RETURN: N/A
 */
-void stop_motors(){
-    left_motor.SetPercent(0);
-    right_motor.SetPercent(0);
+void move_to_light(int direction=1, float speed=LIGHT_APPROACH_SPEED){
+    finish_motion(start_motion(MOTION_TO_LIGHT, 0, direction, speed, 0));
 }
 
 /*
-    Resets the counts for both the left and right motors. Another helper function similar to stop_motors()
-    PARAMS: N/A
-    RETURN: N/A
+    Starts turning in place to an absolute heading and returns immediately. The turn is planned from the heading the robot
+    should have, and start_motion() adds whatever error the pose estimate shows, so no per-turn angle fudging is needed.
+    PARAMS:
+        float heading - course heading to face in degrees, counterclockwise from the x axis
+        float speed - peak motor speed as a percentage
+    RETURN:
+        MotionHandle handle - handle to check on, wait for or cancel the turn
 */
-void reset_motor_counts(){
-    right_encoder.ResetCounts();
-    left_encoder.ResetCounts();
+MotionHandle turn_to_async(float heading, float speed=TURN_SPEED){
+    sync_goal();
+    float angle = wrap_angle(heading * (PI / 180.f) - goal.theta) * (180.f / PI);
+    if(angle >= 0){
+        return(turn_async(angle, LEFT, speed));
+    }
+    return(turn_async(-angle, RIGHT, speed));
 }
 
 /*
-    Sets the proper motor speed to enable turning for the specified angle.  
+    Turns in place to an absolute heading and waits for the turn to finish, see turn_to_async().
     PARAMS:
-        float angle - angle of turn in degrees 
-        int direction - direction of turn; left corresponds to direction = 0, right corresponds to direction = 1
+        float heading - course heading to face in degrees, counterclockwise from the x axis
+        float speed - peak motor speed as a percentage
     RETURN: N/A
 */
-void turn(float angle, int direction){
-    if(direction == 0){
-        right_motor.SetPercent(40.);
-        left_motor.SetPercent(-40.);
-    }
-    else {
-        right_motor.SetPercent(-40.);
-        left_motor.SetPercent(40.);
-    }
-
-    reset_motor_counts();
-
-    float turn_radius_radians = deg_to_rads(angle);
-    while(calculate_distance(right_encoder.Counts()) <= (RADIUS_OF_TURN * turn_radius_radians)){}
-    stop_motors();
-    Sleep(0.5);
+void turn_to(float heading, float speed=TURN_SPEED){
+    finish_motion(turn_to_async(heading, speed));
 }
 
-
 /*
-    Sets the proper motor speed to move forward or in reverse depending on the value of direction.
+    Turns towards a point in course coordinates and drives to it. The path is planned from the estimated pose rather than from
+    where the robot should be, so any drift built up by earlier segments, sideways drift included, is driven out.
     PARAMS:
-        float distance - total distance of motion in inches
+        float x - x of the point in inches
+        float y - y of the point in inches
         int direction - direction of motion, forward by default, but reverse if -1 is specified for direction
-        float speed - motor speed as a percentage
+        float speed - peak motor speed of the drive as a percentage, the turn towards the point runs at TURN_SPEED
     RETURN: N/A
 */
-void move(float distance, int direction=1, float speed=40.){
-    right_motor.SetPercent(speed * direction);
-    left_motor.SetPercent(speed * direction);
-
-    reset_motor_counts();
-
-    while(calculate_distance(right_encoder.Counts()) <= distance && calculate_distance(left_encoder.Counts()) <= distance){}
-    stop_motors();
-    Sleep(0.5);
-}
-
-void move_failsafe(float distance, float failsafe_duration, int direction=1, float speed=40.){
-    right_motor.SetPercent(speed * direction);
-    left_motor.SetPercent(speed * direction);
-
-    reset_motor_counts();
-
-    float time = TimeNow();
-    while((calculate_distance(right_encoder.Counts()) <= distance && calculate_distance(left_encoder.Counts()) <= distance) && TimeNow() < time + failsafe_duration){}
-    stop_motors();
-    Sleep(0.5);
+void go_to(float x, float y, int direction=1, float speed=40.){
+    sync_goal();
+    goal.x = pose.x;
+    goal.y = pose.y;
+    float heading = atan2f(y - pose.y, x - pose.x);
+    if(direction < 0){
+        heading += PI;
+    }
+    turn_to(heading * (180.f / PI));
+    move(sqrtf((x - goal.x) * (x - goal.x) + (y - goal.y) * (y - goal.y)), direction, speed);
 }
 
 /*
-    Modified move() to stop when ticket booth light is reached.
+    Tells the pose estimate which way the robot faces after it squared up against a wall whose direction is known. Squaring
+    turns the robot in ways the encoders only partly see, so this keeps turn_to() and go_to() planning from the true heading.
     PARAMS:
-        int direction - direction of motion, forward by default, but reverse if -1 is specified for direction
+        float heading - course heading the robot faces in degrees, counterclockwise from the x axis
     RETURN: N/A
 */
-void move_to_light(int direction=1){
-    right_motor.SetPercent(40. * direction);
-    left_motor.SetPercent(40. * direction);
-
-    reset_motor_counts();
+void align_heading(float heading){
+    sync_goal();
+    pose.theta = wrap_angle(heading * (PI / 180.f));
+    goal.theta = pose.theta;
+}
 
-    while(read_cds_sensor() > 2.2){}
-    stop_motors();
-    Sleep(0.5);
+/*
+    Chance that a Student t variable with the given degrees of freedom exceeds t, from the closed form of its distribution for a
+    whole number of degrees of freedom.
+    PARAMS:
+        float t - value to exceed, at least 0
+        int df - degrees of freedom, at least 1
+    RETURN:
+        float tail - one-sided tail probability
+*/
+float student_t_tail(float t, int df){
+    float theta = atanf(t / sqrtf((float)df));
+    float c2 = cosf(theta) * cosf(theta);
+    // probability of |T| < t, the series runs over the even or odd powers of cos(theta) depending on df
+    float inside;
+    if(df % 2 == 0){
+        float term = 1.f, sum = 1.f;
+        for(int k = 2; k < df; k += 2){
+            term *= c2 * (k - 1) / k;
+            sum += term;
+        }
+        inside = sinf(theta) * sum;
+    }
+    else {
+        float sum = 0.f;
+        if(df > 1){
+            float term = 1.f;
+            sum = 1.f;
+            for(int k = 3; k < df; k += 2){
+                term *= c2 * (k - 1) / k;
+                sum += term;
+            }
+        }
+        inside = 2.f / PI * (theta + sinf(theta) * cosf(theta) * sum);
+    }
+    return((1.f - inside) / 2.f);
 }
 
 /*
-    Reads the color of the ticket booth light and displays the color to the LCD screen.
+    Result of reading the ticket booth light.
+*/
+struct LightReading {
+    int color; // LIGHT_RED or LIGHT_BLUE, LIGHT_UNKNOWN if the samples did not reach LIGHT_CONFIDENCE within LIGHT_TIMEOUT_MS
+    int likely; // LIGHT_RED or LIGHT_BLUE, whichever color the samples favour, also when color is LIGHT_UNKNOWN
+    float confidence; // Lower bound on the probability that likely is the color of the light, over every test the reading may take
+    int samples; // Number of CdS samples the decision was made on
+};
+
+/*
+    Reads the color of the ticket booth light and displays the color to the LCD screen. Samples are gathered one at a time as
+    sensor_task() takes them, and after each one the mean is tested against color_threshold. The noise is estimated from the
+    samples themselves, so the chance of the mean landing on the wrong side of the threshold is read off the Student t
+    distribution with one degree of freedom less than there are samples. The test is repeated after every sample, and each
+    repetition is one more chance to stop on a fluke, so that chance is multiplied by the number of tests LIGHT_TIMEOUT_MS
+    allows for. Sampling stops once the product drops below 1 - LIGHT_CONFIDENCE, which for a light well away from the threshold
+    takes a few samples; a reading that stays close to the threshold is reported as unknown after LIGHT_TIMEOUT_MS. The likely
+    color is always red or blue, taken from the side of the threshold the mean is on, even before LIGHT_MIN_SAMPLES samples.
     PARAMS: N/A
     RETURN:
-        light_color - int value representing the color of the light, 1 corresponds to red, 2 corresponds to blue
+        LightReading reading - color of the light and how sure the reading is
 */
-int read_light_color(){
-    int light_color;
-    float voltage;
-    float time = TimeNow();
-    while(TimeNow() < time + 1){
-        voltage = read_cds_sensor();
+LightReading read_light_color(){
+    float threshold = color_threshold;
+    // until a sample comes in, the filtered value picks the likely color so the reading always has one
+    LightReading reading = { LIGHT_UNKNOWN, (read_cds_sensor() > threshold) ? LIGHT_BLUE : LIGHT_RED, 0.f, 0 };
+    float mean = 0, squares = 0;
+    unsigned long seen = cds.taken;
+    unsigned long start_ms = TimeNowMSec();
+    while((long)(TimeNowMSec() - start_ms) < LIGHT_TIMEOUT_MS){
+        run_tasks();
+        if(cds.taken == seen){
+            continue;
+        }
+        seen = cds.taken;
+
+        // running mean and sum of squared deviations of the samples taken since the call
+        float sample = cds.samples[(cds.next - 1 + CDS_WINDOW) % CDS_WINDOW];
+        reading.samples++;
+        float delta = sample - mean;
+        mean += delta / reading.samples;
+        squares += delta * (sample - mean);
+        reading.likely = (mean > threshold) ? LIGHT_BLUE : LIGHT_RED;
+        if(reading.samples < LIGHT_MIN_SAMPLES){
+            continue;
+        }
+
+        float noise = sqrtf(squares / (reading.samples - 1));
+        if(noise < CDS_NOISE_FLOOR){
+            noise = CDS_NOISE_FLOOR;
+        }
+        float t = fabsf(mean - threshold) / (noise / sqrtf((float)reading.samples));
+        int tests = LIGHT_TIMEOUT_MS / SENSOR_PERIOD_MS - LIGHT_MIN_SAMPLES + 1;
+        reading.confidence = 1.f - student_t_tail(t, reading.samples - 1) * tests;
+        if(reading.confidence < 0){
+            reading.confidence = 0;
+        }
+        if(reading.confidence >= LIGHT_CONFIDENCE){
+            reading.color = reading.likely;
+            break;
+        }
     }
 
     LCD.Clear();
 
-    time = TimeNow();
-    if(voltage > COLOR_THRESHOLD){
-        // color is blue
+    if(reading.color == LIGHT_BLUE){
         LCD.WriteLine("Blue");
         LCD.SetFontColor(BLUE);
         LCD.FillRectangle(0, 0, 319, 239);
-        while(TimeNow() < time + 0.5){}
-        light_color = 2;
     }
-    else {
-        // color is red
+    else if(reading.color == LIGHT_RED){
         LCD.WriteLine("Red");
         LCD.SetFontColor(RED);
         LCD.FillRectangle(0, 0, 319, 239);
-        while(TimeNow() < time + 0.5){}
-        light_color = 1;
     }
-    return(light_color);
+    else {
+        LCD.Write("Unknown, ");
+        LCD.Write(reading.likely == LIGHT_BLUE ? "Blue" : "Red");
+        LCD.Write(" at ");
+        LCD.WriteLine(reading.confidence);
+    }
+    return(reading);
 }
 
 /*
@@ -238,26 +1870,254 @@ void navigate_to_switch(int switch_id){
 }
 
 /*
-    Continuously outputs the voltage readings of the CdS cell for calibration purposes
+    Continuously outputs the filtered voltage of the CdS cell for calibration purposes. Call after init(), the cell is sampled by
+    sensor_task().
     PARAMS: N/A
     RETURN: N/A
 */
 void calibrate_cds(){
-    // adjust the COLOR_THRESHOLD constant for calibration
+    // shows which side of the current threshold a light falls on, see calibrate_light_thresholds() to move the threshold
     while(true){
         float reading = read_cds_sensor();
         LCD.WriteLine(reading);
-        if(reading > COLOR_THRESHOLD){
+        if(reading > color_threshold){
             LCD.WriteLine("BLUE BASED ON CURRENT THRESHOLD");
         }
         else{
             LCD.WriteLine("RED BASED ON CURRENT THRESHOLD");
         }
-        Sleep(0.5);
+        wait(0.5);
         LCD.Clear();
     }
 }
 
+/*
+    Mean and noise of the CdS cell over one light.
+*/
+struct LightStats {
+    float mean; // Mean voltage
+    float noise; // Standard deviation of the samples in volts, at least CDS_NOISE_FLOOR
+};
+
+/*
+    Runs the scheduler until the screen is tapped. A touch still held from before the call does not count, the screen has to
+    be released and touched again.
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void wait_for_tap(){
+    int x, y;
+    while(LCD.Touch(&x, &y)){
+        run_tasks();
+    }
+    while(!LCD.Touch(&x, &y)){
+        run_tasks();
+    }
+    while(LCD.Touch(&x, &y)){
+        run_tasks();
+    }
+}
+
+/*
+    Asks for the CdS cell to be placed over a light, waits for a tap on the screen and samples the cell for CALIBRATION_MS.
+    PARAMS:
+        const char *light - name of the light shown in the prompt
+    RETURN:
+        LightStats stats - mean and noise of the samples
+*/
+LightStats measure_light(const char *light){
+    LCD.Clear();
+    LCD.Write("PLACE CDS CELL OVER ");
+    LCD.WriteLine(light);
+    LCD.WriteLine("THEN TAP THE SCREEN");
+    wait_for_tap();
+    LCD.WriteLine("SAMPLING");
+
+    float mean = 0, squares = 0;
+    int samples = 0;
+    unsigned long seen = cds.taken;
+    unsigned long start_ms = TimeNowMSec();
+    while((long)(TimeNowMSec() - start_ms) < CALIBRATION_MS){
+        run_tasks();
+        if(cds.taken == seen){
+            continue;
+        }
+        seen = cds.taken;
+        float sample = cds.samples[(cds.next - 1 + CDS_WINDOW) % CDS_WINDOW];
+        samples++;
+        float delta = sample - mean;
+        mean += delta / samples;
+        squares += delta * (sample - mean);
+    }
+
+    LightStats stats;
+    stats.mean = mean;
+    stats.noise = (samples > 1) ? sqrtf(squares / (samples - 1)) : 0.f;
+    if(stats.noise < CDS_NOISE_FLOOR){
+        stats.noise = CDS_NOISE_FLOOR;
+    }
+    return(stats);
+}
+
+/*
+    Places a threshold between a brighter and a dimmer light where a reading is the same number of standard deviations from
+    either mean, which gives both lights the same chance of being mistaken for the other.
+    PARAMS:
+        LightStats brighter - light with the lower CdS voltage
+        LightStats dimmer - light with the higher CdS voltage
+    RETURN:
+        float threshold - CdS voltage between the two lights, or -1 if they are too close to tell apart reliably
+*/
+float light_boundary(LightStats brighter, LightStats dimmer){
+    float spread = brighter.noise + dimmer.noise;
+    if((dimmer.mean - brighter.mean) / spread < CALIBRATION_MIN_SEPARATION){
+        return(-1.f);
+    }
+    return((brighter.mean * dimmer.noise + dimmer.mean * brighter.noise) / spread);
+}
+
+/*
+    Measures the red light, the blue light and the ambient light and places color_threshold between red and blue and
+    ticket_light_threshold between blue, the dimmer light, and ambient. The thresholds are stored on the SD card and loaded by
+    init() on every later run, so a change in room lighting only needs this routine run again instead of a rebuild. Call after
+    init(), the cell is sampled by sensor_task().
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void calibrate_light_thresholds(){
+    LightStats red = measure_light("THE RED LIGHT");
+    LightStats blue = measure_light("THE BLUE LIGHT");
+    LightStats ambient = measure_light("NO LIGHT");
+
+    LCD.Clear();
+    float color = light_boundary(red, blue);
+    float ticket = light_boundary(blue, ambient);
+    if(color < 0 || ticket < 0){
+        LCD.WriteLine("LIGHTS TOO CLOSE, THRESHOLDS NOT CHANGED");
+        return;
+    }
+    color_threshold = color;
+    ticket_light_threshold = ticket;
+    store_light_thresholds();
+
+    LCD.Write("COLOR THRESHOLD ");
+    LCD.WriteLine(color_threshold);
+    LCD.Write("TICKET LIGHT THRESHOLD ");
+    LCD.WriteLine(ticket_light_threshold);
+}
+
+/*
+    Least squares fit of percent = ks + kv * velocity over the samples of the quasistatic test, accumulated one sample at a time
+    so the test needs no sample buffer.
+*/
+struct LineFit {
+    int n; // Number of samples
+    float sum_v; // Sum of wheel speeds
+    float sum_p; // Sum of motor percents
+    float sum_vv; // Sum of squared wheel speeds
+    float sum_vp; // Sum of wheel speed times motor percent
+};
+
+/*
+    Adds a sample to a line fit. Samples below FF_MIN_VELOCITY are left out, the wheel is still stuck or barely turning there.
+    PARAMS:
+        LineFit *fit - fit to add the sample to
+        float velocity - wheel speed in inches per second
+        float percent - motor percent that held the speed
+    RETURN: N/A
+*/
+void add_sample(LineFit *fit, float velocity, float percent){
+    if(velocity < FF_MIN_VELOCITY){
+        return;
+    }
+    fit->n++;
+    fit->sum_v += velocity;
+    fit->sum_p += percent;
+    fit->sum_vv += velocity * velocity;
+    fit->sum_vp += velocity * percent;
+}
+
+/*
+    Measures the feedforward model of both drive wheels, stores it on the SD card and shows it on the LCD. The robot turns in
+    place so it stays where it is; give it room to spin. Two tests are run:
+      - quasistatic: the percent ramps up by FF_RAMP_RATE so slowly that the wheels never accelerate noticeably, and a line
+        through percent against wheel speed gives kS as its intercept and kV as its slope.
+      - step: FF_STEP_PERCENT is applied from rest. Under the model, the speed approaches its steady state with time constant
+        kA / kV, so a wheel that has run for FF_STEP_MS lags a wheel that reached full speed at once by that time constant.
+        Measuring the lag from the distance covered avoids differentiating the encoder counts twice.
+    PARAMS: N/A
+    RETURN: N/A
+*/
+void characterize_motors(){
+    LCD.Clear();
+    LCD.WriteLine("CHARACTERIZING MOTORS");
+
+    // quasistatic test
+    LineFit right_fit = {}, left_fit = {};
+    EncoderSnapshot last = read_encoders();
+    unsigned long start_ms = last.ms;
+    float percent = 0;
+    while(percent < FF_RAMP_PERCENT){
+        percent = FF_RAMP_RATE * (TimeNowMSec() - start_ms) / 1000.f;
+        set_drive(percent, -percent);
+        wait(FF_SAMPLE_MS / 1000.f);
+        EncoderSnapshot counts = read_encoders();
+        float seconds = (counts.ms - last.ms) / 1000.f;
+        add_sample(&right_fit, (counts.right - last.right) / COUNTS_PER_INCH / seconds, percent);
+        add_sample(&left_fit, (counts.left - last.left) / COUNTS_PER_INCH / seconds, percent);
+        last = counts;
+    }
+    stop_motors();
+    settle();
+
+    LineFit *fits[2] = {&right_fit, &left_fit};
+    Feedforward *models[2] = {&right_ff, &left_ff};
+    for(int i = 0; i < 2; i++){
+        LineFit *fit = fits[i];
+        float denominator = fit->n * fit->sum_vv - fit->sum_v * fit->sum_v;
+        if(fit->n < 2 || denominator <= 0){
+            LCD.WriteLine("NOT ENOUGH SAMPLES, NOTHING STORED");
+            return;
+        }
+        models[i]->kv = (fit->n * fit->sum_vp - fit->sum_v * fit->sum_p) / denominator;
+        models[i]->ks = (fit->sum_p - models[i]->kv * fit->sum_v) / fit->n;
+    }
+
+    // step test
+    EncoderSnapshot start = read_encoders();
+    set_drive(FF_STEP_PERCENT, -FF_STEP_PERCENT);
+    wait((FF_STEP_MS - FF_STEP_TAIL_MS) / 1000.f);
+    EncoderSnapshot tail = read_encoders();
+    wait(FF_STEP_TAIL_MS / 1000.f);
+    EncoderSnapshot end = read_encoders();
+    stop_motors();
+    settle();
+
+    float seconds = (end.ms - start.ms) / 1000.f;
+    float tail_seconds = (end.ms - tail.ms) / 1000.f;
+    int distance[2] = {end.right - start.right, end.left - start.left};
+    int tail_distance[2] = {end.right - tail.right, end.left - tail.left};
+    for(int i = 0; i < 2; i++){
+        // steady state speed, then the lag behind a wheel that ran at it from the start
+        float velocity = tail_distance[i] / tail_seconds;
+        float lag = seconds - distance[i] / velocity;
+        if(velocity > 0 && lag > 0){
+            models[i]->ka = models[i]->kv * lag;
+        }
+    }
+
+    store_feedforward();
+
+    for(int i = 0; i < 2; i++){
+        LCD.Write(i == 0 ? "RIGHT kS " : "LEFT kS ");
+        LCD.Write(models[i]->ks);
+        LCD.Write(" kV ");
+        LCD.Write(models[i]->kv);
+        LCD.Write(" kA ");
+        LCD.WriteLine(models[i]->ka);
+    }
+}
+
 /*
     Adjusts the position of the servo motor to the input angle.
     PARAMS:
@@ -266,7 +2126,7 @@ void calibrate_cds(){
 */
 void move_servo(float angle){
     // LEFT MOST PORT WITH BLACK WIRE ON TOP
-    servo_arm.SetDegree(angle);
+    set_servo(angle);
 }
 
 
@@ -281,121 +2141,511 @@ void init(){
 
     servo_arm.SetMin(SERVO_MIN);
     servo_arm.SetMax(SERVO_MAX);
+
+    load_braking();
+    load_light_thresholds();
+
+    // start the average from a real reading so the first motions are already compensated
+    battery_voltage = Battery.Voltage();
+    battery_task();
+
+    add_task("watch", watch_task, 0);
+    add_task("motion", motion_task, MOTION_PERIOD_MS);
+    add_task("pose", pose_task, CONTROL_PERIOD_MS);
+    add_task("sensor", sensor_task, SENSOR_PERIOD_MS);
+    add_task("battery", battery_task, BATTERY_PERIOD_MS);
+    add_task("display", display_task, DISPLAY_PERIOD_MS);
+
+    learn_start_baseline();
 }
 
-int main(void)
-{
+// ----------- MISSION -----------
 
-    // ---------- UNCOMMENT THIS TO CALIBRATE ----------
-    // calibrate_cds();
+// Command opcodes executed by run_mission()
+#define CMD_MOVE 0 // Straight segment, see move()
+#define CMD_MOVE_ASYNC 1 // Straight segment that runs on while the following commands execute, see move_async()
+#define CMD_TURN 2 // Turn in place, see turn()
+#define CMD_FAILSAFE 3 // Straight segment with a time limit, see move_failsafe()
+#define CMD_MOVE_TO_LIGHT 4 // Straight segment until the ticket booth light, see move_to_light()
+#define CMD_SYNC 5 // Waits for a CMD_MOVE_ASYNC segment to finish and the robot to settle
+#define CMD_SERVO 6 // Moves the servo arm, see move_servo()
+#define CMD_WAIT 7 // Waits a fixed time
+#define CMD_MARK 8 // Remembers the current time for CMD_WAIT_SINCE_MARK
+#define CMD_WAIT_SINCE_MARK 9 // Waits until a fixed time has passed since the last CMD_MARK
+#define CMD_STATUS 10 // Sets the course phase shown on the LCD, see set_status()
+#define CMD_READ_LIGHT 11 // Reads the ticket booth light color, see read_light_color()
+#define CMD_READ_LEVER 12 // Asks the RCS for the correct fuel lever
+#define CMD_BRANCH_ON_LIGHT 13 // Skips the next commands unless the light color read last matches
+#define CMD_BRANCH_ON_LEVER 14 // Skips the next commands unless the lever read last matches
+#define CMD_TURN_TO 15 // Turns in place to an absolute heading, see turn_to()
+#define CMD_GO_TO 16 // Drives to a point in course coordinates, see go_to()
+#define CMD_ALIGN 17 // Sets the heading of the pose estimate after squaring on a wall, see align_heading()
+#define CMD_ARC 18 // Constant curvature segment, see arc()
 
-    init();
+/*
+    One step of the mission. Distances and angles are converted to encoder counts when the table is compiled, so the
+    interpreter never does unit conversions. Build commands with the constexpr helpers below rather than by hand.
+*/
+struct Command {
+    int op; // One of the CMD_ values
+    int counts; // Target encoder counts of a motion
+    int direction; // FORWARD or REVERSE for straight segments, right wheel direction for turns
+    float value; // Peak motor percent of a motion, or servo angle in degrees
+    int ms; // Duration of a wait or time limit of a failsafe segment in milliseconds
+    int match; // Light color or lever a branch compares against
+    int skip; // Number of commands a branch skips when it does not match
+    const char *text; // Course phase of a CMD_STATUS command
+    float x; // x of a CMD_GO_TO point in inches
+    float y; // y of a CMD_GO_TO point in inches
+    float heading; // Course heading of a CMD_TURN_TO or CMD_ALIGN in degrees
+    float radius; // Turning radius of a CMD_ARC in inches, positive to the left and negative to the right
+};
+
+constexpr Command MOVE(float distance, int direction=FORWARD, float speed=40.f){
+    return(Command{ CMD_MOVE, distance_to_counts(distance), direction, speed, 0, 0, 0, nullptr, 0, 0, 0, 0 });
+}
+
+constexpr Command MOVE_ASYNC(float distance, int direction=FORWARD, float speed=40.f){
+    return(Command{ CMD_MOVE_ASYNC, distance_to_counts(distance), direction, speed, 0, 0, 0, nullptr, 0, 0, 0, 0 });
+}
+
+constexpr Command TURN(float angle, int direction, float speed=TURN_SPEED){
+    // the right wheel drives forward for a left turn and backward for a right turn
+    return(Command{ CMD_TURN, angle_to_counts(angle), direction == LEFT ? 1 : -1, speed, 0, 0, 0, nullptr, 0, 0, 0, 0 });
+}
+
+constexpr Command ARC(float radius, float angle, int direction, float speed=40.f){
+    return(Command{ CMD_ARC, distance_to_counts(radius * angle * (PI / 180.f)), FORWARD, speed, 0, 0, 0, nullptr, 0, 0, 0,
+        direction == LEFT ? radius : -radius });
+}
+
+constexpr Command FAILSAFE(float distance, float seconds, int direction=FORWARD, float speed=40.f){
+    return(Command{ CMD_FAILSAFE, distance_to_counts(distance), direction, speed, (int)(seconds * 1000), 0, 0, nullptr, 0, 0, 0, 0 });
+}
+
+constexpr Command MOVE_TO_LIGHT(int direction=FORWARD){
+    return(Command{ CMD_MOVE_TO_LIGHT, 0, direction, LIGHT_APPROACH_SPEED, 0, 0, 0, nullptr, 0, 0, 0, 0 });
+}
+
+constexpr Command TURN_TO(float heading, float speed=TURN_SPEED){
+    return(Command{ CMD_TURN_TO, 0, 0, speed, 0, 0, 0, nullptr, 0, 0, heading, 0 });
+}
+
+constexpr Command GO_TO(float x, float y, int direction=FORWARD, float speed=40.f){
+    return(Command{ CMD_GO_TO, 0, direction, speed, 0, 0, 0, nullptr, x, y, 0, 0 });
+}
+
+constexpr Command ALIGN(float heading){
+    return(Command{ CMD_ALIGN, 0, 0, 0, 0, 0, 0, nullptr, 0, 0, heading, 0 });
+}
+
+constexpr Command SYNC(){
+    return(Command{ CMD_SYNC, 0, 0, 0, 0, 0, 0, nullptr, 0, 0, 0, 0 });
+}
+
+constexpr Command SERVO(float angle){
+    return(Command{ CMD_SERVO, 0, 0, angle, 0, 0, 0, nullptr, 0, 0, 0, 0 });
+}
+
+constexpr Command WAIT(float seconds){
+    return(Command{ CMD_WAIT, 0, 0, 0, (int)(seconds * 1000), 0, 0, nullptr, 0, 0, 0, 0 });
+}
+
+constexpr Command MARK(){
+    return(Command{ CMD_MARK, 0, 0, 0, 0, 0, 0, nullptr, 0, 0, 0, 0 });
+}
+
+constexpr Command WAIT_SINCE_MARK(float seconds){
+    return(Command{ CMD_WAIT_SINCE_MARK, 0, 0, 0, (int)(seconds * 1000), 0, 0, nullptr, 0, 0, 0, 0 });
+}
 
-    while(read_cds_sensor() > 2.0){}
-    
+constexpr Command STATUS(const char *phase){
+    return(Command{ CMD_STATUS, 0, 0, 0, 0, 0, 0, phase, 0, 0, 0, 0 });
+}
+
+constexpr Command READ_LIGHT(){
+    return(Command{ CMD_READ_LIGHT, 0, 0, 0, 0, 0, 0, nullptr, 0, 0, 0, 0 });
+}
+
+constexpr Command READ_LEVER(){
+    return(Command{ CMD_READ_LEVER, 0, 0, 0, 0, 0, 0, nullptr, 0, 0, 0, 0 });
+}
+
+constexpr Command BRANCH_ON_LIGHT(int color, int length){
+    return(Command{ CMD_BRANCH_ON_LIGHT, 0, 0, 0, 0, color, length, nullptr, 0, 0, 0, 0 });
+}
+
+constexpr Command BRANCH_ON_LEVER(int lever, int length){
+    return(Command{ CMD_BRANCH_ON_LEVER, 0, 0, 0, 0, lever, length, nullptr, 0, 0, 0, 0 });
+}
+
+/*
+    Checks a mission table at compile time: branches must stay inside the table, waits must not be negative, arcs must not be
+    tighter than RADIUS_OF_TURN and every CMD_MOVE_ASYNC must be followed by a CMD_SYNC before the next motion.
+    PARAMS:
+        const Command *mission - mission table
+        int length - number of commands in the table
+    RETURN:
+        bool valid - true when the table passes every check
+*/
+constexpr bool mission_is_valid(const Command *mission, int length){
+    bool motion_pending = false;
+    for(int i = 0; i < length; i++){
+        const Command &command = mission[i];
+        switch(command.op){
+            case CMD_BRANCH_ON_LIGHT:
+            case CMD_BRANCH_ON_LEVER:
+                if(command.skip < 0 || i + command.skip >= length){
+                    return(false);
+                }
+                break;
+            case CMD_WAIT:
+            case CMD_WAIT_SINCE_MARK:
+                if(command.ms < 0){
+                    return(false);
+                }
+                break;
+            case CMD_ARC:
+                if(command.radius < RADIUS_OF_TURN && command.radius > -RADIUS_OF_TURN){
+                    return(false);
+                }
+                if(motion_pending){
+                    return(false);
+                }
+                break;
+            case CMD_MOVE:
+            case CMD_TURN:
+            case CMD_FAILSAFE:
+            case CMD_MOVE_TO_LIGHT:
+            case CMD_TURN_TO:
+            case CMD_GO_TO:
+            case CMD_ALIGN:
+                if(motion_pending){
+                    return(false);
+                }
+                break;
+            case CMD_MOVE_ASYNC:
+                if(motion_pending){
+                    return(false);
+                }
+                motion_pending = true;
+                break;
+            case CMD_SYNC:
+                motion_pending = false;
+                break;
+        }
+    }
+    return(!motion_pending);
+}
+
+/*
+    Looks ahead from a path segment (CMD_MOVE or CMD_ARC) for the segment it can blend into. A segment blends into the next one
+    when that is another path segment in the same direction, directly or behind a CMD_TURN of at most BLEND_MAX_ANGLE degrees.
+    A straight segment joins an arc tangentially and blends into it; an arc ends with a stop. Anything else (a reversal, a
+    larger turn, a servo or sensor action, a branch) needs the robot to stop first.
+    PARAMS:
+        const Command *mission - mission table
+        int length - number of commands in the table
+        int pc - index of the path segment
+    RETURN:
+        int next - index of the path segment to blend into, or -1 when the robot has to stop at the end of the segment
+*/
+int blend_target(const Command *mission, int length, int pc){
+    // leaving an arc the outer wheel has to slow down while the inner one speeds up, and the heading runs on for as long as the
+    // motors lag behind; stopping at the end of the arc is the only way the next segment starts on the right heading
+    if(mission[pc].op == CMD_ARC){
+        return(-1);
+    }
+    int next = pc + 1;
+    if(next < length && mission[next].op == CMD_TURN && mission[next].counts <= angle_to_counts(BLEND_MAX_ANGLE)){
+        next++;
+    }
+    bool path = next < length && (mission[next].op == CMD_MOVE || mission[next].op == CMD_ARC);
+    if(path && mission[next].direction == mission[pc].direction){
+        return(next);
+    }
+    return(-1);
+}
+
+/*
+    Speed carried through the junction of two blended path segments. Like a CNC junction deviation limit, the sharper the
+    junction the slower the robot passes it: straight junctions keep the lower of the two peak speeds. A skipped turn lowers the
+    speed linearly to PROFILE_START_PERCENT at a BLEND_MAX_ANGLE turn so the heading controller has room to steer the turn in.
+    A change of curvature, entering or leaving an arc, makes the wheel speeds jump apart or together, so it lowers the speed by
+    how far the wheel speeds have to jump.
+    PARAMS:
+        const Command &in - segment ending at the junction
+        const Command &out - segment starting at the junction
+        int turn_counts - encoder counts of the turn between the segments, 0 for a straight junction
+    RETURN:
+        float percent - motor percent at the junction
+*/
+float junction_percent(const Command &in, const Command &out, int turn_counts){
+    float peak = in.value < out.value ? in.value : out.value;
+    float in_curvature = (in.op == CMD_ARC) ? 1.f / in.radius : 0.f;
+    float out_curvature = (out.op == CMD_ARC) ? 1.f / out.radius : 0.f;
+    float sharpness = fabsf(out_curvature - in_curvature) * RADIUS_OF_TURN + (float)turn_counts / angle_to_counts(BLEND_MAX_ANGLE);
+    if(sharpness > 1.f){
+        sharpness = 1.f;
+    }
+    return(peak - (peak - PROFILE_START_PERCENT) * sharpness);
+}
+
+/*
+    Executes a mission table from start to finish.
+    PARAMS:
+        const Command *mission - mission table
+        int length - number of commands in the table
+    RETURN: N/A
+*/
+void run_mission(const Command *mission, int length){
+    int light_color = LIGHT_UNKNOWN;
+    int lever = -1;
+    unsigned long mark_ms = TimeNowMSec();
+    MotionHandle pending = { 0 };
+    float entry_percent = PROFILE_START_PERCENT; // speed carried into the next path segment from a blended one
+
+    for(int pc = 0; pc < length; pc++){
+        const Command &command = mission[pc];
+        switch(command.op){
+            case CMD_MOVE:
+            case CMD_ARC: {
+                int type = (command.op == CMD_ARC) ? MOTION_ARC : MOTION_MOVE;
+                int next = blend_target(mission, length, pc);
+                if(next < 0){
+                    finish_motion(start_motion(type, command.counts, command.direction, command.value, 0, entry_percent,
+                        PROFILE_START_PERCENT, false, command.radius));
+                    entry_percent = PROFILE_START_PERCENT;
+                    break;
+                }
+                int turn_counts = 0;
+                if(next == pc + 2){
+                    turn_counts = mission[pc + 1].counts;
+                }
+                float exit_percent = junction_percent(command, mission[next], turn_counts);
+                start_motion(type, command.counts, command.direction, command.value, 0, entry_percent, exit_percent, true,
+                    command.radius).wait();
+                // a skipped turn only goes into the plan, the next segment sees it as heading error and steers it in
+                if(next == pc + 2){
+                    plan_turn(turn_counts, mission[pc + 1].direction);
+                }
+                entry_percent = exit_percent;
+                pc = next - 1;
+                break;
+            }
+            case CMD_MOVE_ASYNC:
+                pending = start_motion(MOTION_MOVE, command.counts, command.direction, command.value, 0);
+                break;
+            case CMD_TURN:
+                finish_motion(start_motion(MOTION_TURN, command.counts, command.direction, command.value, 0));
+                break;
+            case CMD_FAILSAFE:
+                finish_motion(start_motion(MOTION_FAILSAFE, command.counts, command.direction, command.value, command.ms));
+                break;
+            case CMD_MOVE_TO_LIGHT:
+                finish_motion(start_motion(MOTION_TO_LIGHT, 0, command.direction, command.value, 0));
+                break;
+            case CMD_SYNC:
+                finish_motion(pending);
+                break;
+            case CMD_TURN_TO:
+                turn_to(command.heading, command.value);
+                break;
+            case CMD_GO_TO:
+                go_to(command.x, command.y, command.direction, command.value);
+                break;
+            case CMD_ALIGN:
+                align_heading(command.heading);
+                break;
+            case CMD_SERVO:
+                move_servo(command.value);
+                break;
+            case CMD_WAIT:
+                wait(command.ms / 1000.f);
+                break;
+            case CMD_MARK:
+                mark_ms = TimeNowMSec();
+                break;
+            case CMD_WAIT_SINCE_MARK:
+                wait((command.ms - (long)(TimeNowMSec() - mark_ms)) / 1000.f);
+                break;
+            case CMD_STATUS:
+                set_status(command.text);
+                break;
+            case CMD_READ_LIGHT:
+                {
+                    // the boarding pass branch needs a color, so an unknown reading goes with the more likely one
+                    LightReading reading = read_light_color();
+                    light_color = (reading.color == LIGHT_UNKNOWN) ? reading.likely : reading.color;
+                }
+                break;
+            case CMD_READ_LEVER:
+                lever = RCS.GetCorrectLever();
+                break;
+            case CMD_BRANCH_ON_LIGHT:
+                if(light_color != command.match){
+                    pc += command.skip;
+                }
+                break;
+            case CMD_BRANCH_ON_LEVER:
+                if(lever != command.match){
+                    pc += command.skip;
+                }
+                break;
+        }
+    }
+}
+
+constexpr Command MISSION[] = {
     /* ---------- LUGGAGE DROP ---------- */
-    move_failsafe(3., 0.75, REVERSE);
-    move(1., FORWARD);
-    turn(40., RIGHT);
-    move(18., FORWARD);
-    turn(2.5, LEFT);
-    move(19.,FORWARD);
-    turn(87., LEFT);
-    move(12.25, FORWARD);
-    turn(85., RIGHT);
-    move(1., REVERSE);
-    for(float i = 180.; i >= 110.; i -= 10){
-        move_servo(i);
-        Sleep(0.1);    
-    }
-    move_servo(180.);
-    Sleep(0.2);
-    move(4.5, FORWARD);
-    
+    STATUS("Luggage drop"),
+    FAILSAFE(3., 0.75, REVERSE),
+    ALIGN(90.),
+    // one arc off the wall instead of move(1), turn 40 right, move(18); the straight leg ends about 0.3 in to the side of
+    // the old corner and the 2.5 deg correction below absorbs the remaining 1 deg
+    ARC(4., 40., RIGHT),
+    MOVE(16.2, FORWARD),
+    TURN(2.5, LEFT),
+    MOVE(19., FORWARD),
+    TURN_TO(142.5),
+    MOVE(12.25, FORWARD),
+    TURN_TO(52.5),
+    MOVE(1., REVERSE),
+    SERVO(180.), WAIT(0.1),
+    SERVO(170.), WAIT(0.1),
+    SERVO(160.), WAIT(0.1),
+    SERVO(150.), WAIT(0.1),
+    SERVO(140.), WAIT(0.1),
+    SERVO(130.), WAIT(0.1),
+    SERVO(120.), WAIT(0.1),
+    SERVO(110.), WAIT(0.1),
+    // the arm retracts while the robot drives away from the luggage bin
+    MOVE_ASYNC(4.5, FORWARD),
+    SERVO(180.),
+    SYNC(),
+
     /* ---------- LIGHT READING ---------- */
-    
-    turn(87., LEFT);
-    move_failsafe(999., 2., FORWARD);
-    move(8.75, REVERSE);
-    turn(83., RIGHT);
-    move_to_light(FORWARD);
-    int light_color = read_light_color();
-    move(2.0, REVERSE);
-    turn(80.0, RIGHT);
-    
+    STATUS("Light reading"),
+    TURN_TO(142.5),
+    FAILSAFE(999., 2., FORWARD),
+    ALIGN(180.),
+    MOVE(8.75, REVERSE),
+    TURN_TO(90.),
+    MOVE_TO_LIGHT(FORWARD),
+    READ_LIGHT(),
+    MOVE(2.0, REVERSE),
+    TURN_TO(0.),
+
     /* ---------- BOARDING PASS BUTTONS ---------- */
-    
-    // RED
-    if(light_color == 1){
-        move(6.25, FORWARD);
-        turn(83.0, LEFT);
-        move(6.5, FORWARD, 55.);
-        move(7., REVERSE);
-        turn(83., LEFT);
-        move(7.5, FORWARD);
-    }
-    // BLUE
-    else {
-        move(9.0, FORWARD);
-        turn(85.0, LEFT);
-        move(5.5, FORWARD, 55.);
-        move(7., REVERSE);
-        turn(81., LEFT);
-        move(11.5, FORWARD);
-    }
+    STATUS("Boarding pass"),
+    BRANCH_ON_LIGHT(LIGHT_RED, 6),
+        MOVE(6.25, FORWARD),
+        TURN_TO(90.),
+        MOVE(6.5, FORWARD, 55.),
+        MOVE(7., REVERSE),
+        TURN_TO(180.),
+        MOVE(7.5, FORWARD),
+    BRANCH_ON_LIGHT(LIGHT_BLUE, 6),
+        MOVE(9.0, FORWARD),
+        TURN_TO(90.),
+        MOVE(5.5, FORWARD, 55.),
+        MOVE(7., REVERSE),
+        TURN_TO(180.),
+        MOVE(11.5, FORWARD),
 
     /* ---------- PASSPORT STAMP ---------- */
-    move_servo(0.);
-    move(6.25, REVERSE);
-    Sleep(1.5);
-    move_servo(135.);
-    turn(40., LEFT);
-    turn(15., RIGHT);
+    STATUS("Passport stamp"),
+    SERVO(0.),
+    MOVE(6.25, REVERSE),
+    WAIT(1.5),
+    SERVO(135.),
+    TURN(40., LEFT),
+    TURN(15., RIGHT),
 
     /* ---------- FUEL LEVERS ---------- */
-    move_failsafe(999., 2.75, FORWARD);
-    move_servo(180.);
-    move(5.0, REVERSE);
-    turn(81.5, RIGHT);
-    int correctLever = RCS.GetCorrectLever();
-    // int correctLever = 2;
-    move(28.5, REVERSE);
-    if(correctLever == 0){
-        //  LEFT - A
-        turn(83., LEFT);
-        move(6.5, REVERSE);
-        turn(83., RIGHT);
-    }
-    else if(correctLever == 1){
-        //  MIDDLE - A1
-        turn(83., LEFT);
-        move(3, REVERSE);
-        turn(83., RIGHT);
-        move(1., FORWARD);
-    }
-    else{
-        //  RIGHT - B
-    }
-    move_servo(45.);
-    Sleep(.2);
-    move(3.5, FORWARD);
-    move_servo(0.);
-    Sleep(5.);
-    move(2.75, REVERSE);
-    move_servo(60.);
-    Sleep(.3);
+    STATUS("Fuel levers"),
+    FAILSAFE(999., 2.75, FORWARD),
+    ALIGN(180.),
+    SERVO(180.),
+    MOVE(5.0, REVERSE),
+    TURN_TO(90.),
+    READ_LEVER(),
+    MOVE(28.5, REVERSE),
+    //  LEFT - A
+    BRANCH_ON_LEVER(0, 3),
+        TURN_TO(180.),
+        MOVE(6.5, REVERSE),
+        TURN_TO(90.),
+    //  MIDDLE - A1
+    BRANCH_ON_LEVER(1, 4),
+        TURN_TO(180.),
+        MOVE(3, REVERSE),
+        TURN_TO(90.),
+        MOVE(1., FORWARD),
+    //  RIGHT - B needs no repositioning
+    SERVO(45.),
+    WAIT(.2),
+    MOVE(3.5, FORWARD),
+    SERVO(0.),
+    // the lever has to stay down for 5 seconds, back off and raise the arm under it in the meantime
+    MARK(),
+    MOVE(2.75, REVERSE),
+    SERVO(60.),
+    WAIT(.3),
+    WAIT_SINCE_MARK(5.),
 
     /* ---------- FINAL BUTTON ---------- */
-    move(2., FORWARD);
-    move_servo(180.);
-    move(4., REVERSE);
-    turn(83., RIGHT);
-    move_failsafe(999., 2.5, FORWARD);
-    move(3.5, REVERSE);
-    turn(83., RIGHT);
-    move(16., FORWARD, 45.);
-    turn(45., LEFT);
-    move(4., FORWARD, 60.);
+    STATUS("Final button"),
+    MOVE(2., FORWARD),
+    SERVO(180.),
+    MOVE(4., REVERSE),
+    TURN_TO(0.),
+    FAILSAFE(999., 2.5, FORWARD),
+    ALIGN(0.),
+    MOVE(3.5, REVERSE),
+    TURN_TO(-90.),
+    // the 45 deg corner is rounded with a 4 in arc, each straight leg is shortened by its tangent length 4 * tan(22.5 deg)
+    MOVE(14.34, FORWARD, 45.),
+    ARC(4., 45., LEFT, 45.),
+    MOVE(2.34, FORWARD, 60.)
+};
+
+#define MISSION_LENGTH ((int)(sizeof(MISSION) / sizeof(MISSION[0]))) // Number of commands in MISSION
+
+static_assert(mission_is_valid(MISSION, MISSION_LENGTH), "MISSION has a branch, wait or async motion that does not fit the table");
+
+int main(void)
+{
+
+    init();
+
+    // ---------- UNCOMMENT THIS TO CALIBRATE ----------
+    // calibrate_cds();
+
+    // ---------- UNCOMMENT THIS TO CHARACTERIZE THE DRIVE MOTORS ----------
+    // characterize_motors();
+    // return 0;
+
+    // touching the screen while the robot waits for the start light calibrates the light thresholds first
+    LCD.WriteLine("TOUCH TO CALIBRATE LIGHTS");
+    run_tasks_until(start_light_or_touch);
+    if(start_detector.touched){
+        calibrate_light_thresholds();
+        LCD.WriteLine("PLACE ROBOT AT THE START");
+        LCD.WriteLine("THEN TAP THE SCREEN");
+        wait_for_tap();
+        learn_start_baseline();
+        run_tasks_until(start_light_on);
+    }
+
+    run_mission(MISSION, MISSION_LENGTH);
+
+    report_start();
+    report_overruns();
+    report_braking();
+    report_pose();
+
+    store_braking();
 
     return 0;
-}
\ No newline at end of file
+}
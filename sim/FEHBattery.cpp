@@ -0,0 +1,14 @@
+#include <FEHBattery.h>
+#include "sim.h"
+
+FEHBattery Battery(FEHIO::BATTERY_VOLTAGE);
+
+FEHBattery::FEHBattery(FEHIO::FEHIOPin pin)
+    : pin_(pin)
+{
+}
+
+float FEHBattery::Voltage(){
+    sim_charge(SIM_COST_ADC);
+    return(sim_battery_voltage());
+}
@@ -0,0 +1,22 @@
+#ifndef FEHBATTERY_H
+#define FEHBATTERY_H
+
+#include <FEHIO.h>
+
+// Host simulation of the Proteus battery monitor. Reads the pack voltage from
+// the battery model in sim.cpp, which sags under motor load.
+
+class FEHBattery
+{
+public:
+    FEHBattery(FEHIO::FEHIOPin pin);
+
+    float Voltage();
+
+private:
+    FEHIO::FEHIOPin pin_;
+};
+
+extern FEHBattery Battery;
+
+#endif // FEHBATTERY_H
@@ -0,0 +1,80 @@
+#include <FEHIO.h>
+#include "sim.h"
+
+DigitalInputPin::DigitalInputPin()
+    : pin_(FEHIO::P0_0)
+{
+}
+
+DigitalInputPin::DigitalInputPin(FEHIO::FEHIOPin pin)
+    : pin_(pin)
+{
+}
+
+void DigitalInputPin::Initialize(FEHIO::FEHIOPin pin){
+    pin_ = pin;
+}
+
+bool DigitalInputPin::Value(){
+    // Pins are pulled up and nothing on the simulated course pulls them low
+    sim_charge(SIM_COST_ENCODER);
+    return(true);
+}
+
+DigitalOutputPin::DigitalOutputPin(FEHIO::FEHIOPin pin)
+    : pin_(pin), value_(false)
+{
+}
+
+void DigitalOutputPin::Write(bool value){
+    value_ = value;
+}
+
+bool DigitalOutputPin::Status(){
+    return(value_);
+}
+
+void DigitalOutputPin::Toggle(){
+    value_ = !value_;
+}
+
+AnalogInputPin::AnalogInputPin(FEHIO::FEHIOPin pin)
+    : pin_(pin)
+{
+}
+
+float AnalogInputPin::Value(){
+    sim_charge(SIM_COST_ADC);
+    return(sim_analog_value(pin_));
+}
+
+DigitalEncoder::DigitalEncoder()
+    : pin_(FEHIO::P0_0)
+{
+}
+
+DigitalEncoder::DigitalEncoder(FEHIO::FEHIOPin pin)
+    : pin_(pin)
+{
+}
+
+DigitalEncoder::DigitalEncoder(FEHIO::FEHIOPin pin, FEHIO::FEHIOInterruptTrigger trigger)
+    : pin_(pin)
+{
+    (void)trigger;
+}
+
+void DigitalEncoder::Initialize(FEHIO::FEHIOPin pin, FEHIO::FEHIOInterruptTrigger trigger){
+    (void)trigger;
+    pin_ = pin;
+}
+
+int DigitalEncoder::Counts(){
+    sim_charge(SIM_COST_ENCODER);
+    return(sim_encoder_counts(pin_));
+}
+
+void DigitalEncoder::ResetCounts(){
+    sim_charge(SIM_COST_ENCODER);
+    sim_reset_encoder(pin_);
+}
@@ -0,0 +1,84 @@
+#ifndef FEHIO_H
+#define FEHIO_H
+
+// Host simulation of the Proteus I/O pins. Analog pins and encoders are
+// wired to the course and drivetrain models in sim.cpp.
+
+class FEHIO
+{
+public:
+    typedef enum
+    {
+        P0_0 = 0, P0_1, P0_2, P0_3, P0_4, P0_5, P0_6, P0_7,
+        P1_0, P1_1, P1_2, P1_3, P1_4, P1_5, P1_6, P1_7,
+        P2_0, P2_1, P2_2, P2_3, P2_4, P2_5, P2_6, P2_7,
+        P3_0, P3_1, P3_2, P3_3, P3_4, P3_5, P3_6, P3_7,
+        BATTERY_VOLTAGE
+    } FEHIOPin;
+
+    typedef enum
+    {
+        Bank0 = 0,
+        Bank1,
+        Bank2,
+        Bank3
+    } FEHIOPort;
+
+    typedef enum
+    {
+        RisingEdge = 0,
+        FallingEdge,
+        EitherEdge
+    } FEHIOInterruptTrigger;
+};
+
+class DigitalInputPin
+{
+public:
+    DigitalInputPin();
+    DigitalInputPin(FEHIO::FEHIOPin pin);
+    void Initialize(FEHIO::FEHIOPin pin);
+    bool Value();
+
+private:
+    FEHIO::FEHIOPin pin_;
+};
+
+class DigitalOutputPin
+{
+public:
+    DigitalOutputPin(FEHIO::FEHIOPin pin);
+    void Write(bool value);
+    bool Status();
+    void Toggle();
+
+private:
+    FEHIO::FEHIOPin pin_;
+    bool value_;
+};
+
+class AnalogInputPin
+{
+public:
+    AnalogInputPin(FEHIO::FEHIOPin pin);
+    float Value();
+
+private:
+    FEHIO::FEHIOPin pin_;
+};
+
+class DigitalEncoder
+{
+public:
+    DigitalEncoder();
+    DigitalEncoder(FEHIO::FEHIOPin pin);
+    DigitalEncoder(FEHIO::FEHIOPin pin, FEHIO::FEHIOInterruptTrigger trigger);
+    void Initialize(FEHIO::FEHIOPin pin, FEHIO::FEHIOInterruptTrigger trigger);
+    int Counts();
+    void ResetCounts();
+
+private:
+    FEHIO::FEHIOPin pin_;
+};
+
+#endif // FEHIO_H
@@ -0,0 +1,239 @@
+#include <FEHLCD.h>
+#include "sim.h"
+
+#include <cstdio>
+#include <cstring>
+
+FEHLCD LCD;
+
+FEHLCD::FEHLCD()
+    : line_len_(0)
+{
+    line_[0] = '\0';
+}
+
+// Text is buffered until the line is complete so Write() sequences are
+// logged as a single entry, like the row they produce on the screen
+void FEHLCD::Emit(const char *text, bool newline){
+    if(*text != '\0'){
+        sim_charge(SIM_COST_LCD_TEXT);
+    }
+    int len = (int)strlen(text);
+    int room = (int)sizeof(line_) - 1 - line_len_;
+    if(len > room){
+        len = room;
+    }
+    memcpy(line_ + line_len_, text, len);
+    line_len_ += len;
+    line_[line_len_] = '\0';
+    if(newline){
+        sim_log("LCD: %s", line_);
+        line_len_ = 0;
+        line_[0] = '\0';
+    }
+}
+
+void FEHLCD::Clear(){
+    sim_charge(SIM_COST_LCD_FILL);
+    line_len_ = 0;
+    line_[0] = '\0';
+}
+
+void FEHLCD::Clear(FEHLCDColor color){
+    (void)color;
+    Clear();
+}
+
+void FEHLCD::Clear(unsigned int color){
+    (void)color;
+    Clear();
+}
+
+void FEHLCD::SetFontColor(FEHLCDColor color){
+    (void)color;
+}
+
+void FEHLCD::SetFontColor(unsigned int color){
+    (void)color;
+}
+
+void FEHLCD::SetBackgroundColor(FEHLCDColor color){
+    (void)color;
+}
+
+void FEHLCD::SetBackgroundColor(unsigned int color){
+    (void)color;
+}
+
+void FEHLCD::DrawPixel(int x, int y){
+    (void)x; (void)y;
+}
+
+void FEHLCD::DrawHorizontalLine(int y, int x1, int x2){
+    (void)y; (void)x1; (void)x2;
+    sim_charge(SIM_COST_LCD_TEXT);
+}
+
+void FEHLCD::DrawVerticalLine(int x, int y1, int y2){
+    (void)x; (void)y1; (void)y2;
+    sim_charge(SIM_COST_LCD_TEXT);
+}
+
+void FEHLCD::DrawLine(int x1, int y1, int x2, int y2){
+    (void)x1; (void)y1; (void)x2; (void)y2;
+    sim_charge(SIM_COST_LCD_TEXT);
+}
+
+void FEHLCD::DrawRectangle(int x, int y, int width, int height){
+    (void)x; (void)y; (void)width; (void)height;
+    sim_charge(SIM_COST_LCD_TEXT);
+}
+
+void FEHLCD::FillRectangle(int x, int y, int width, int height){
+    // Cost scales with the filled area, a full screen takes SIM_COST_LCD_FILL
+    (void)x; (void)y;
+    sim_charge(SIM_COST_LCD_FILL * (width * height) / (320.0 * 240.0));
+}
+
+void FEHLCD::DrawCircle(int x0, int y0, int r){
+    (void)x0; (void)y0; (void)r;
+    sim_charge(SIM_COST_LCD_TEXT);
+}
+
+void FEHLCD::FillCircle(int x0, int y0, int r){
+    (void)x0; (void)y0;
+    sim_charge(SIM_COST_LCD_FILL * (3.14159 * r * r) / (320.0 * 240.0));
+}
+
+void FEHLCD::Write(const char *str){
+    Emit(str, false);
+}
+
+void FEHLCD::Write(int i){
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "%d", i);
+    Emit(buffer, false);
+}
+
+void FEHLCD::Write(float f){
+    Write((double)f);
+}
+
+void FEHLCD::Write(double d){
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.3f", d);
+    Emit(buffer, false);
+}
+
+void FEHLCD::Write(bool b){
+    Emit(b ? "true" : "false", false);
+}
+
+void FEHLCD::Write(char c){
+    char buffer[2] = { c, '\0' };
+    Emit(buffer, false);
+}
+
+void FEHLCD::WriteLine(const char *str){
+    Write(str);
+    Emit("", true);
+}
+
+void FEHLCD::WriteLine(int i){
+    Write(i);
+    Emit("", true);
+}
+
+void FEHLCD::WriteLine(float f){
+    Write(f);
+    Emit("", true);
+}
+
+void FEHLCD::WriteLine(double d){
+    Write(d);
+    Emit("", true);
+}
+
+void FEHLCD::WriteLine(bool b){
+    Write(b);
+    Emit("", true);
+}
+
+void FEHLCD::WriteLine(char c){
+    Write(c);
+    Emit("", true);
+}
+
+void FEHLCD::WriteAt(const char *str, int x, int y){
+    (void)x; (void)y;
+    WriteLine(str);
+}
+
+void FEHLCD::WriteAt(int i, int x, int y){
+    (void)x; (void)y;
+    WriteLine(i);
+}
+
+void FEHLCD::WriteAt(float f, int x, int y){
+    (void)x; (void)y;
+    WriteLine(f);
+}
+
+void FEHLCD::WriteAt(double d, int x, int y){
+    (void)x; (void)y;
+    WriteLine(d);
+}
+
+void FEHLCD::WriteAt(bool b, int x, int y){
+    (void)x; (void)y;
+    WriteLine(b);
+}
+
+void FEHLCD::WriteAt(char c, int x, int y){
+    (void)x; (void)y;
+    WriteLine(c);
+}
+
+void FEHLCD::WriteRC(const char *str, int row, int col){
+    (void)row; (void)col;
+    WriteLine(str);
+}
+
+void FEHLCD::WriteRC(int i, int row, int col){
+    (void)row; (void)col;
+    WriteLine(i);
+}
+
+void FEHLCD::WriteRC(float f, int row, int col){
+    (void)row; (void)col;
+    WriteLine(f);
+}
+
+void FEHLCD::WriteRC(double d, int row, int col){
+    (void)row; (void)col;
+    WriteLine(d);
+}
+
+void FEHLCD::WriteRC(bool b, int row, int col){
+    (void)row; (void)col;
+    WriteLine(b);
+}
+
+void FEHLCD::WriteRC(char c, int row, int col){
+    (void)row; (void)col;
+    WriteLine(c);
+}
+
+bool FEHLCD::Touch(float *x_pos, float *y_pos){
+    sim_charge(SIM_COST_ADC);
+    *x_pos = 0;
+    *y_pos = 0;
+    return(false);
+}
+
+bool FEHLCD::Touch(int *x_pos, int *y_pos){
+    sim_charge(SIM_COST_ADC);
+    *x_pos = 0;
+    *y_pos = 0;
+    return(false);
+}
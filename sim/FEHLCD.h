@@ -0,0 +1,84 @@
+#ifndef FEHLCD_H
+#define FEHLCD_H
+
+#include <FEHUtility.h>
+#include <LCDColors.h>
+
+// Host simulation of the Proteus LCD. Text output is echoed to stdout with
+// the virtual timestamp; drawing calls only cost simulated time.
+
+class FEHLCD
+{
+public:
+    typedef enum
+    {
+        Black = 0,
+        White,
+        Red,
+        Green,
+        Blue,
+        Scarlet,
+        Gray
+    } FEHLCDColor;
+
+    FEHLCD();
+
+    void Clear();
+    void Clear(FEHLCDColor color);
+    void Clear(unsigned int color);
+
+    void SetFontColor(FEHLCDColor color);
+    void SetFontColor(unsigned int color);
+    void SetBackgroundColor(FEHLCDColor color);
+    void SetBackgroundColor(unsigned int color);
+
+    void DrawPixel(int x, int y);
+    void DrawHorizontalLine(int y, int x1, int x2);
+    void DrawVerticalLine(int x, int y1, int y2);
+    void DrawLine(int x1, int y1, int x2, int y2);
+    void DrawRectangle(int x, int y, int width, int height);
+    void FillRectangle(int x, int y, int width, int height);
+    void DrawCircle(int x0, int y0, int r);
+    void FillCircle(int x0, int y0, int r);
+
+    void Write(const char *str);
+    void Write(int i);
+    void Write(float f);
+    void Write(double d);
+    void Write(bool b);
+    void Write(char c);
+
+    void WriteLine(const char *str);
+    void WriteLine(int i);
+    void WriteLine(float f);
+    void WriteLine(double d);
+    void WriteLine(bool b);
+    void WriteLine(char c);
+
+    void WriteAt(const char *str, int x, int y);
+    void WriteAt(int i, int x, int y);
+    void WriteAt(float f, int x, int y);
+    void WriteAt(double d, int x, int y);
+    void WriteAt(bool b, int x, int y);
+    void WriteAt(char c, int x, int y);
+
+    void WriteRC(const char *str, int row, int col);
+    void WriteRC(int i, int row, int col);
+    void WriteRC(float f, int row, int col);
+    void WriteRC(double d, int row, int col);
+    void WriteRC(bool b, int row, int col);
+    void WriteRC(char c, int row, int col);
+
+    bool Touch(float *x_pos, float *y_pos);
+    bool Touch(int *x_pos, int *y_pos);
+
+private:
+    void Emit(const char *text, bool newline);
+
+    char line_[64];
+    int line_len_;
+};
+
+extern FEHLCD LCD;
+
+#endif // FEHLCD_H
@@ -0,0 +1,21 @@
+#include <FEHMotor.h>
+#include "sim.h"
+
+FEHMotor::FEHMotor(FEHMotorPort motor_port, float max_voltage)
+    : port_(motor_port), max_voltage_(max_voltage)
+{
+}
+
+void FEHMotor::Stop(){
+    SetPercent(0);
+}
+
+void FEHMotor::SetPercent(float percent){
+    sim_charge(SIM_COST_MOTOR);
+    sim_set_motor(port_, percent, max_voltage_);
+}
+
+void FEHMotor::SetPower(int power){
+    // Power is the raw -128..127 PWM value on the Proteus
+    SetPercent(power * 100.f / 127.f);
+}
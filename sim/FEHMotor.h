@@ -0,0 +1,29 @@
+#ifndef FEHMOTOR_H
+#define FEHMOTOR_H
+
+// Host simulation of a Proteus motor port. Commands are forwarded to the
+// drivetrain model in sim.cpp.
+
+class FEHMotor
+{
+public:
+    typedef enum
+    {
+        Motor0 = 0,
+        Motor1,
+        Motor2,
+        Motor3
+    } FEHMotorPort;
+
+    FEHMotor(FEHMotorPort motor_port, float max_voltage);
+
+    void Stop();
+    void SetPercent(float percent);
+    void SetPower(int power);
+
+private:
+    FEHMotorPort port_;
+    float max_voltage_;
+};
+
+#endif // FEHMOTOR_H
@@ -0,0 +1,40 @@
+#include <FEHRCS.h>
+#include "sim.h"
+
+FEHRCS RCS;
+
+FEHRCS::FEHRCS(){
+}
+
+void FEHRCS::InitializeTouchMenu(const char *team_key){
+    sim_log("RCS: initialized for team %s", team_key);
+}
+
+void FEHRCS::InitializeMenu(const char *team_key){
+    InitializeTouchMenu(team_key);
+}
+
+void FEHRCS::Initialize(const char *team_key){
+    InitializeTouchMenu(team_key);
+}
+
+int FEHRCS::GetCorrectLever(){
+    return(sim_correct_lever());
+}
+
+int FEHRCS::Time(){
+    return((int)sim_time());
+}
+
+int FEHRCS::CurrentRegion(){
+    return(0);
+}
+
+char FEHRCS::CurrentRegionLetter(){
+    return('A');
+}
+
+char *FEHRCS::CurrentCourse(){
+    static char course[] = "SIM";
+    return(course);
+}
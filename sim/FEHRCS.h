@@ -0,0 +1,24 @@
+#ifndef FEHRCS_H
+#define FEHRCS_H
+
+// Host simulation of the Robot Communication System. The correct lever is
+// taken from the SIM_LEVER environment variable (default 1).
+
+class FEHRCS
+{
+public:
+    FEHRCS();
+
+    void InitializeTouchMenu(const char *team_key);
+    void InitializeMenu(const char *team_key);
+    void Initialize(const char *team_key);
+    int GetCorrectLever();
+    int Time();
+    int CurrentRegion();
+    char CurrentRegionLetter();
+    char *CurrentCourse();
+};
+
+extern FEHRCS RCS;
+
+#endif // FEHRCS_H
@@ -0,0 +1,92 @@
+#include <FEHSD.h>
+#include "sim.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define SIM_SD_MAX_FILES 8 // Files that may be open at once, the same limit as the firmware
+
+FEHSD SD;
+
+static FEHFile *open_files[SIM_SD_MAX_FILES];
+
+FEHSD::FEHSD(){
+}
+
+int FEHSD::Initialize(){
+    return(0);
+}
+
+FEHFile *FEHSD::FOpen(const char *str, const char *mode){
+    sim_charge(SIM_COST_SD);
+    int slot = 0;
+    while(slot < SIM_SD_MAX_FILES && open_files[slot] != NULL){
+        slot++;
+    }
+    if(slot == SIM_SD_MAX_FILES){
+        sim_log("SD: too many open files, cannot open %s", str);
+        return(NULL);
+    }
+    const char *dir = getenv("SIM_SD");
+    if(dir == NULL){
+        dir = "sim/build/sd";
+    }
+    mkdir(dir, 0755);
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, str);
+    FILE *file = fopen(path, mode);
+    if(file == NULL){
+        sim_log("SD: cannot open %s", path);
+        return(NULL);
+    }
+    FEHFile *fptr = new FEHFile;
+    fptr->file = file;
+    open_files[slot] = fptr;
+    return(fptr);
+}
+
+int FEHSD::FClose(FEHFile *fptr){
+    sim_charge(SIM_COST_SD);
+    for(int i = 0; i < SIM_SD_MAX_FILES; i++){
+        if(open_files[i] == fptr){
+            open_files[i] = NULL;
+            int result = fclose(fptr->file);
+            delete fptr;
+            return(result);
+        }
+    }
+    return(-1);
+}
+
+int FEHSD::FCloseAll(){
+    int result = 0;
+    for(int i = 0; i < SIM_SD_MAX_FILES; i++){
+        if(open_files[i] != NULL && FClose(open_files[i]) != 0){
+            result = -1;
+        }
+    }
+    return(result);
+}
+
+int FEHSD::FPrintf(FEHFile *fptr, const char *format, ...){
+    sim_charge(SIM_COST_SD);
+    va_list args;
+    va_start(args, format);
+    int result = vfprintf(fptr->file, format, args);
+    va_end(args);
+    return(result);
+}
+
+int FEHSD::FScanf(FEHFile *fptr, const char *format, ...){
+    sim_charge(SIM_COST_SD);
+    va_list args;
+    va_start(args, format);
+    int result = vfscanf(fptr->file, format, args);
+    va_end(args);
+    return(result);
+}
+
+int FEHSD::FEof(FEHFile *fptr){
+    return(feof(fptr->file));
+}
@@ -0,0 +1,31 @@
+#ifndef FEHSD_H
+#define FEHSD_H
+
+#include <stdio.h>
+
+// Host simulation of the Proteus SD card. Files live in the directory named by
+// the SIM_SD environment variable (default sim/build/sd), so values a run
+// stores are there for the next run, the same as on the robot.
+
+struct FEHFile
+{
+    FILE *file;
+};
+
+class FEHSD
+{
+public:
+    FEHSD();
+
+    int Initialize();
+    FEHFile *FOpen(const char *str, const char *mode);
+    int FClose(FEHFile *fptr);
+    int FCloseAll();
+    int FPrintf(FEHFile *fptr, const char *format, ...);
+    int FScanf(FEHFile *fptr, const char *format, ...);
+    int FEof(FEHFile *fptr);
+};
+
+extern FEHSD SD;
+
+#endif // FEHSD_H
@@ -0,0 +1,38 @@
+#include <FEHServo.h>
+#include "sim.h"
+
+FEHServo::FEHServo(FEHServoPort servo_port)
+    : port_(servo_port), min_(500), max_(2500)
+{
+}
+
+void FEHServo::SetMin(int min){
+    min_ = min;
+}
+
+void FEHServo::SetMax(int max){
+    max_ = max;
+}
+
+void FEHServo::SetDegree(float degree){
+    sim_charge(SIM_COST_SERVO);
+    sim_set_servo(port_, degree);
+}
+
+void FEHServo::TouchCalibrate(){
+    sim_log("servo%d TouchCalibrate() is not supported in simulation", port_);
+}
+
+void FEHServo::Calibrate(){
+    TouchCalibrate();
+}
+
+void FEHServo::Off(){
+    sim_charge(SIM_COST_SERVO);
+}
+
+void FEHServo::DigitalOn(){
+}
+
+void FEHServo::DigitalOff(){
+}
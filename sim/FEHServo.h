@@ -0,0 +1,39 @@
+#ifndef FEHSERVO_H
+#define FEHSERVO_H
+
+// Host simulation of a Proteus servo port. Only the commanded angle is
+// modelled; calibration values are stored but have no effect.
+
+class FEHServo
+{
+public:
+    typedef enum
+    {
+        Servo0 = 0,
+        Servo1,
+        Servo2,
+        Servo3,
+        Servo4,
+        Servo5,
+        Servo6,
+        Servo7
+    } FEHServoPort;
+
+    FEHServo(FEHServoPort servo_port);
+
+    void SetMin(int min);
+    void SetMax(int max);
+    void SetDegree(float degree);
+    void TouchCalibrate();
+    void Calibrate();
+    void Off();
+    void DigitalOn();
+    void DigitalOff();
+
+private:
+    FEHServoPort port_;
+    int min_;
+    int max_;
+};
+
+#endif // FEHSERVO_H
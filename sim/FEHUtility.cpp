@@ -0,0 +1,29 @@
+#include <FEHUtility.h>
+#include "sim.h"
+
+double TimeNow(){
+    sim_charge(SIM_COST_TIME);
+    return(sim_time());
+}
+
+unsigned int TimeNowSec(){
+    sim_charge(SIM_COST_TIME);
+    return((unsigned int)sim_time());
+}
+
+unsigned long TimeNowMSec(){
+    sim_charge(SIM_COST_TIME);
+    return((unsigned long)(sim_time() * 1000));
+}
+
+void Sleep(int msec){
+    sim_charge(msec / 1000.0);
+}
+
+void Sleep(float sec){
+    sim_charge(sec);
+}
+
+void Sleep(double sec){
+    sim_charge(sec);
+}
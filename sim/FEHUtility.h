@@ -0,0 +1,16 @@
+#ifndef FEHUTILITY_H
+#define FEHUTILITY_H
+
+// Host simulation of the Proteus utility library. Time is virtual: it only
+// advances through Sleep() and through the modelled cost of each HAL call,
+// so busy-wait loops in main.cpp make progress and run faster than real time.
+
+double TimeNow();
+unsigned int TimeNowSec();
+unsigned long TimeNowMSec();
+
+void Sleep(int msec);
+void Sleep(float sec);
+void Sleep(double sec);
+
+#endif // FEHUTILITY_H
@@ -0,0 +1,17 @@
+#ifndef LCDCOLORS_H
+#define LCDCOLORS_H
+
+// Subset of the 24-bit color constants provided by the Proteus LCD library
+
+#define BLACK 0x000000u
+#define WHITE 0xFFFFFFu
+#define RED 0xFF0000u
+#define GREEN 0x008000u
+#define BLUE 0x0000FFu
+#define YELLOW 0xFFFF00u
+#define GRAY 0x808080u
+#define SCARLET 0xBB0000u
+#define LIGHTGREEN 0x90EE90u
+#define DARKGRAY 0xA9A9A9u
+
+#endif // LCDCOLORS_H
@@ -0,0 +1,472 @@
+#include "sim.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// ----------- MODEL PARAMETERS -----------
+
+#define SIM_STEP 5e-5 // Physics integration step in seconds
+#define SIM_TRACK_WIDTH 8.0 // Distance between the wheels in inches, twice RADIUS_OF_TURN in main.cpp
+#define SIM_WHEEL_RADIUS 1.5 // Wheel radius in inches
+#define SIM_COUNTS_PER_REVOLUTION 318 // Encoder counts per wheel revolution for IGWAN motors
+#define SIM_SPEED_PER_VOLT 2.6 // Free-running wheel speed in inches per second per applied volt
+#define SIM_STALL_VOLTS 0.6 // Applied voltage below which a stationary wheel does not break free
+#define SIM_DRIVE_TAU 0.12 // Time constant of the wheel speed response under power, seconds
+#define SIM_COAST_TAU 0.06 // Time constant of the wheel speed decay with the motor at 0%, seconds
+#define SIM_COAST_FRICTION 30.0 // Constant friction deceleration while coasting, inches per second squared
+#define SIM_BUMPER_HALF_LENGTH 3.5 // Distance from the wheel axle to the front and back bumpers in inches
+#define SIM_BUMPER_HALF_WIDTH 2.0 // Distance from the chassis center line to the ends of each bumper in inches
+#define SIM_WALL_WEST -40.0 // Course walls in course inches, origin at the start light
+#define SIM_WALL_EAST 40.0
+#define SIM_WALL_SOUTH -40.0
+#define SIM_WALL_NORTH 80.0
+#define SIM_CDS_OFFSET 2.0 // Distance of the CdS cell ahead of the wheel axle in inches
+#define SIM_CDS_AMBIENT 3.0 // CdS cell voltage with no course light in view
+#define SIM_LIGHT_SPREAD 1.2 // Distance in inches at which a light has half its peak effect
+#define SIM_START_LIGHT_DEPTH 2.0 // Voltage drop directly over the start light
+#define SIM_RED_LIGHT_DEPTH 2.6 // Voltage drop directly over the red ticket booth light
+#define SIM_BLUE_LIGHT_DEPTH 1.1 // Voltage drop directly over the blue ticket booth light
+#define SIM_TICKET_LIGHT_X 21.25 // Default ticket booth light position in course inches, origin at the start light
+#define SIM_TICKET_LIGHT_Y 47.5
+#define SIM_BATTERY_REFERENCE 11.5 // Battery voltage at which a motor outputs its max_voltage at 100%
+#define SIM_BATTERY_SAG 0.6 // Battery voltage drop under load, volts per unit of total drive duty
+#define SIM_BATTERY_DRAIN 0.01 // Open circuit voltage lost per second of full duty on one motor
+#define SIM_SKEW_WINDOW 5e-4 // Writes to both drive motors this close together in seconds count as one drive update for SIM_SKEW
+
+/*
+ * The course geometry follows the hand tuned mission the team ran on the real course, driven as
+ * commanded from the start pose (0, -2) heading 90 with its trimmed 85-87 degree turns taken as the
+ * square turns they stand for:
+ * - move_failsafe(3., 0.75, REVERSE) then move(1.) backs the rear bumper into a wall under 3 inches
+ *   behind it and pulls off again, so the starting wall sits 1 inch behind the bumper at y = -6.5.
+ * - The luggage drop leg leaves the robot near (15.6, 37.1) facing 142.5 degrees, and
+ *   move_failsafe(999., 2., FORWARD) squares it on the ticket booth wall with its axle 3.5 inches off
+ *   the wall face. move(8.75, REVERSE) and the right turn then leave the CdS cell on the line
+ *   x = wall + 3.5 + 8.75, which puts the light at x = 9 + 12.25 = 21.25 for the wall face at x = 9.
+ * - The mission finds the light with move_to_light() rather than a fixed distance, so its y only has
+ *   to be a short drive north of where the robot leaves the wall (about y = 39.4).
+ * The same mission, built unchanged against this simulator, reads both light colors correctly.
+ */
+
+// Solid blocks on the course floor as { x_min, y_min, x_max, y_max } in course inches
+static const double SIM_OBSTACLES[][4] = {
+    { -10.0, -40.0, 10.0, -6.5 }, // Wall behind the starting position
+    { -40.0, 30.0, 9.0, 80.0 } // Ticket booth wall squared against before reading the light
+};
+
+struct SimWheel {
+    int port;
+    int encoder_pin;
+    double gain;
+    double duty; // Commanded PWM duty, -1 to 1; the applied voltage is this times the battery voltage
+    double velocity;
+    double travel;
+    long counts_offset;
+    double last_write; // Virtual time of the last command to this motor, negative before the first
+    bool paired; // True once the last command has been matched with one to the other motor by SIM_SKEW
+};
+
+struct SimSkew {
+    long updates; // Drive updates that wrote both motors
+    long right_first; // Updates that wrote the right motor first
+    double total; // Sum of the time between the two writes of every update
+    double max; // Longest time between the two writes of an update
+};
+
+struct SimWorld {
+    bool initialized;
+    double time;
+    double pending;
+    double x;
+    double y;
+    double heading;
+    SimWheel left;
+    SimWheel right;
+    float servo_degree[8];
+    bool ticket_light_red;
+    double ticket_light_x;
+    double ticket_light_y;
+    int lever;
+    double start_delay;
+    double noise;
+    unsigned long long seed;
+    double battery; // Open circuit battery voltage
+    bool trace;
+    bool skew;
+    SimSkew skew_stats;
+    double timeout;
+    std::chrono::steady_clock::time_point wall_start;
+};
+
+static double env_double(const char *name, double fallback){
+    const char *value = getenv(name);
+    if(value == NULL || *value == '\0'){
+        return(fallback);
+    }
+    return(atof(value));
+}
+
+static SimWorld &world(){
+    static SimWorld w;
+    if(!w.initialized){
+        w = SimWorld();
+        w.initialized = true;
+        w.left.port = SIM_LEFT_MOTOR_PORT;
+        w.left.encoder_pin = SIM_LEFT_ENCODER_PIN;
+        w.left.gain = env_double("SIM_LEFT_GAIN", 0.97);
+        w.right.port = SIM_RIGHT_MOTOR_PORT;
+        w.right.encoder_pin = SIM_RIGHT_ENCODER_PIN;
+        w.right.gain = env_double("SIM_RIGHT_GAIN", 1.0);
+        const char *light = getenv("SIM_LIGHT");
+        w.ticket_light_red = (light == NULL || strcmp(light, "blue") != 0);
+        w.ticket_light_x = env_double("SIM_LIGHT_X", SIM_TICKET_LIGHT_X);
+        w.ticket_light_y = env_double("SIM_LIGHT_Y", SIM_TICKET_LIGHT_Y);
+        w.lever = (int)env_double("SIM_LEVER", 1);
+        w.start_delay = env_double("SIM_START_DELAY", 1.0);
+        w.noise = env_double("SIM_NOISE", 0.015);
+        w.seed = (unsigned long long)env_double("SIM_SEED", 1);
+        w.battery = env_double("SIM_BATTERY", SIM_BATTERY_REFERENCE);
+        w.trace = env_double("SIM_TRACE", 0) != 0;
+        w.skew = env_double("SIM_SKEW", 0) != 0;
+        w.left.last_write = -1;
+        w.right.last_write = -1;
+        w.timeout = env_double("SIM_TIMEOUT", 300);
+        // The robot starts with its CdS cell over the start light, facing +y
+        w.heading = M_PI / 2;
+        w.y = -SIM_CDS_OFFSET;
+        w.wall_start = std::chrono::steady_clock::now();
+    }
+    return(w);
+}
+
+// ----------- PHYSICS -----------
+
+// Battery voltage under the current motor load
+static double battery_voltage(const SimWorld &w){
+    return(w.battery - SIM_BATTERY_SAG * (fabs(w.left.duty) + fabs(w.right.duty)));
+}
+
+static void step_wheel(SimWheel &wheel, double battery, double dt){
+    double drive = wheel.duty * battery * wheel.gain;
+    if(wheel.velocity == 0 && fabs(drive) < SIM_STALL_VOLTS){
+        return;
+    }
+    if(drive != 0){
+        double target = drive * SIM_SPEED_PER_VOLT;
+        wheel.velocity += (target - wheel.velocity) * (dt / SIM_DRIVE_TAU);
+    }
+    else {
+        double decel = wheel.velocity / SIM_COAST_TAU + (wheel.velocity > 0 ? SIM_COAST_FRICTION : -SIM_COAST_FRICTION);
+        double next = wheel.velocity - decel * dt;
+        // Friction cannot reverse the wheel
+        wheel.velocity = (next * wheel.velocity <= 0) ? 0 : next;
+    }
+}
+
+// Returns the shortest axis-aligned move that takes a point out of the course walls and obstacles, zero if it is clear
+static void wall_exit(double x, double y, double *dx, double *dy){
+    *dx = 0;
+    *dy = 0;
+    if(x < SIM_WALL_WEST){
+        *dx = SIM_WALL_WEST - x;
+    }
+    else if(x > SIM_WALL_EAST){
+        *dx = SIM_WALL_EAST - x;
+    }
+    if(y < SIM_WALL_SOUTH){
+        *dy = SIM_WALL_SOUTH - y;
+    }
+    else if(y > SIM_WALL_NORTH){
+        *dy = SIM_WALL_NORTH - y;
+    }
+    for(unsigned int i = 0; i < sizeof(SIM_OBSTACLES) / sizeof(SIM_OBSTACLES[0]); i++){
+        const double *block = SIM_OBSTACLES[i];
+        if(x <= block[0] || x >= block[2] || y <= block[1] || y >= block[3]){
+            continue;
+        }
+        double exits[4] = { block[0] - x, block[2] - x, block[1] - y, block[3] - y };
+        int best = 0;
+        for(int j = 1; j < 4; j++){
+            if(fabs(exits[j]) < fabs(exits[best])){
+                best = j;
+            }
+        }
+        if(best < 2){
+            *dx = exits[best];
+        }
+        else {
+            *dy = exits[best];
+        }
+    }
+}
+
+// Finds the translation that resolves every bumper contact at the given pose and reports which chassis sides
+// (bit 0 = left, bit 1 = right) are touching
+static int wall_contacts(double x, double y, double heading, double *push_x, double *push_y){
+    static const double bumpers[4][2] = {
+        { SIM_BUMPER_HALF_LENGTH, SIM_BUMPER_HALF_WIDTH },
+        { -SIM_BUMPER_HALF_LENGTH, SIM_BUMPER_HALF_WIDTH },
+        { SIM_BUMPER_HALF_LENGTH, -SIM_BUMPER_HALF_WIDTH },
+        { -SIM_BUMPER_HALF_LENGTH, -SIM_BUMPER_HALF_WIDTH }
+    };
+    double c = cos(heading);
+    double s = sin(heading);
+    int contacts = 0;
+    *push_x = 0;
+    *push_y = 0;
+    for(int i = 0; i < 4; i++){
+        double dx, dy;
+        wall_exit(x + bumpers[i][0] * c - bumpers[i][1] * s, y + bumpers[i][0] * s + bumpers[i][1] * c, &dx, &dy);
+        if(dx == 0 && dy == 0){
+            continue;
+        }
+        contacts |= (bumpers[i][1] > 0) ? 1 : 2;
+        if(fabs(dx) > fabs(*push_x)){
+            *push_x = dx;
+        }
+        if(fabs(dy) > fabs(*push_y)){
+            *push_y = dy;
+        }
+    }
+    return(contacts);
+}
+
+static void integrate_pose(const SimWorld &w, double dt, double *x, double *y, double *heading){
+    double v = (w.left.velocity + w.right.velocity) / 2;
+    double omega = (w.right.velocity - w.left.velocity) / SIM_TRACK_WIDTH;
+    double mid_heading = w.heading + omega * dt / 2;
+    *x = w.x + v * cos(mid_heading) * dt;
+    *y = w.y + v * sin(mid_heading) * dt;
+    *heading = w.heading + omega * dt;
+}
+
+static void step(SimWorld &w, double dt){
+    double battery = battery_voltage(w);
+    step_wheel(w.left, battery, dt);
+    step_wheel(w.right, battery, dt);
+    w.battery -= SIM_BATTERY_DRAIN * (fabs(w.left.duty) + fabs(w.right.duty)) * dt;
+
+    // Friction at a bumper pressed against a wall stalls the wheel on that side, so the robot pivots
+    // about it and slides along the wall until both sides are flush, squaring up like the real robot
+    double x, y, heading, push_x, push_y;
+    integrate_pose(w, dt, &x, &y, &heading);
+    int contacts = wall_contacts(x, y, heading, &push_x, &push_y);
+    if(contacts != 0){
+        if(contacts & 1){
+            w.left.velocity = 0;
+        }
+        if(contacts & 2){
+            w.right.velocity = 0;
+        }
+        integrate_pose(w, dt, &x, &y, &heading);
+        wall_contacts(x, y, heading, &push_x, &push_y);
+        x += push_x;
+        y += push_y;
+    }
+
+    w.left.travel += fabs(w.left.velocity) * dt;
+    w.right.travel += fabs(w.right.velocity) * dt;
+    w.x = x;
+    w.y = y;
+    w.heading = heading;
+    w.time += dt;
+}
+
+void sim_charge(double seconds){
+    SimWorld &w = world();
+    w.pending += seconds;
+    while(w.pending >= SIM_STEP){
+        step(w, SIM_STEP);
+        w.pending -= SIM_STEP;
+    }
+    if(w.time > w.timeout){
+        sim_log("timed out, aborting run");
+        exit(1);
+    }
+}
+
+double sim_time(){
+    SimWorld &w = world();
+    return(w.time + w.pending);
+}
+
+// ----------- DEVICES -----------
+
+static SimWheel *wheel_for_port(int port){
+    SimWorld &w = world();
+    if(port == w.left.port){
+        return(&w.left);
+    }
+    if(port == w.right.port){
+        return(&w.right);
+    }
+    return(NULL);
+}
+
+static SimWheel *wheel_for_pin(int pin){
+    SimWorld &w = world();
+    if(pin == w.left.encoder_pin){
+        return(&w.left);
+    }
+    if(pin == w.right.encoder_pin){
+        return(&w.right);
+    }
+    return(NULL);
+}
+
+static long wheel_counts(const SimWheel &wheel){
+    return((long)(wheel.travel * SIM_COUNTS_PER_REVOLUTION / (2 * M_PI * SIM_WHEEL_RADIUS)));
+}
+
+// Pairs a motor command with a recent one to the other drive motor and records the time between them
+static void record_skew(SimWorld &w, SimWheel &wheel){
+    SimWheel &other = (&wheel == &w.left) ? w.right : w.left;
+    double now = sim_time();
+    wheel.last_write = now;
+    wheel.paired = false;
+    if(other.last_write < 0 || other.paired || now - other.last_write > SIM_SKEW_WINDOW){
+        return;
+    }
+    double skew = now - other.last_write;
+    wheel.paired = true;
+    other.paired = true;
+    w.skew_stats.updates++;
+    if(&other == &w.right){
+        w.skew_stats.right_first++;
+    }
+    w.skew_stats.total += skew;
+    if(skew > w.skew_stats.max){
+        w.skew_stats.max = skew;
+    }
+}
+
+void sim_set_motor(int port, float percent, float max_voltage){
+    SimWheel *wheel = wheel_for_port(port);
+    if(percent > 100){
+        percent = 100;
+    }
+    if(percent < -100){
+        percent = -100;
+    }
+    SimWorld &w = world();
+    if(w.trace){
+        sim_log("motor%d %.1f%% at x=%.2f y=%.2f heading=%.1f", port, percent, w.x, w.y, w.heading * 180 / M_PI);
+    }
+    if(wheel != NULL){
+        wheel->duty = percent / 100.0 * max_voltage / SIM_BATTERY_REFERENCE;
+        if(w.skew){
+            record_skew(w, *wheel);
+        }
+    }
+}
+
+void sim_set_servo(int port, float degree){
+    SimWorld &w = world();
+    if(port >= 0 && port < 8){
+        w.servo_degree[port] = degree;
+    }
+    if(w.trace){
+        sim_log("servo%d %.1f deg", port, degree);
+    }
+}
+
+int sim_encoder_counts(int pin){
+    SimWheel *wheel = wheel_for_pin(pin);
+    if(wheel == NULL){
+        return(0);
+    }
+    return((int)(wheel_counts(*wheel) - wheel->counts_offset));
+}
+
+void sim_reset_encoder(int pin){
+    SimWheel *wheel = wheel_for_pin(pin);
+    if(wheel != NULL){
+        wheel->counts_offset = wheel_counts(*wheel);
+    }
+}
+
+static double light_effect(double depth, double dx, double dy){
+    // Shielded CdS cells see a sharp peak directly over a light
+    double d2 = (dx * dx + dy * dy) / (SIM_LIGHT_SPREAD * SIM_LIGHT_SPREAD);
+    return(depth / (1 + d2 * d2 * d2));
+}
+
+static double noise_sample(SimWorld &w){
+    if(w.noise <= 0){
+        return(0);
+    }
+    // Box-Muller over a 64-bit LCG so runs are reproducible for a given seed
+    double u[2];
+    for(int i = 0; i < 2; i++){
+        w.seed = w.seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        u[i] = ((w.seed >> 11) + 1.0) / 9007199254740993.0;
+    }
+    return(w.noise * sqrt(-2 * log(u[0])) * cos(2 * M_PI * u[1]));
+}
+
+float sim_battery_voltage(){
+    return((float)battery_voltage(world()));
+}
+
+float sim_analog_value(int pin){
+    SimWorld &w = world();
+    if(pin != SIM_CDS_PIN){
+        return(0);
+    }
+    double sx = w.x + SIM_CDS_OFFSET * cos(w.heading);
+    double sy = w.y + SIM_CDS_OFFSET * sin(w.heading);
+    double value = SIM_CDS_AMBIENT;
+    if(sim_time() >= w.start_delay){
+        value -= light_effect(SIM_START_LIGHT_DEPTH, sx, sy);
+    }
+    double depth = w.ticket_light_red ? SIM_RED_LIGHT_DEPTH : SIM_BLUE_LIGHT_DEPTH;
+    value -= light_effect(depth, sx - w.ticket_light_x, sy - w.ticket_light_y);
+    value += noise_sample(w);
+    if(value < 0){
+        value = 0;
+    }
+    if(value > 3.3){
+        value = 3.3;
+    }
+    return((float)value);
+}
+
+int sim_correct_lever(){
+    return(world().lever);
+}
+
+void sim_log(const char *format, ...){
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    printf("[%9.4f] %s\n", sim_time(), buffer);
+}
+
+// ----------- RUN SUMMARY -----------
+
+struct SimSummary {
+    ~SimSummary(){
+        SimWorld &w = world();
+        double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - w.wall_start).count();
+        double heading = fmod(w.heading * 180 / M_PI, 360);
+        if(heading < 0){
+            heading += 360;
+        }
+        printf("[sim] finished at %.3f s virtual, %.3f s wall (%.0fx real time)\n",
+            sim_time(), wall, wall > 0 ? sim_time() / wall : 0);
+        printf("[sim] final pose x=%.2f in y=%.2f in heading=%.1f deg\n", w.x, w.y, heading);
+        if(w.skew){
+            const SimSkew &k = w.skew_stats;
+            printf("[sim] motor skew: %ld paired updates, right first %ld, left first %ld, mean %.1f us, max %.1f us\n",
+                k.updates, k.right_first, k.updates - k.right_first, k.updates > 0 ? k.total / k.updates * 1e6 : 0, k.max * 1e6);
+        }
+    }
+};
+
+static SimSummary summary;
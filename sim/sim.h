@@ -0,0 +1,62 @@
+#ifndef SIM_H
+#define SIM_H
+
+// Drivetrain and course model behind the simulated FEH libraries.
+//
+// The model owns a virtual clock. Every HAL call charges a fixed cost that
+// approximates how long the same call takes on the Proteus, and Sleep()
+// charges its full duration, so the unmodified mission advances exactly as
+// fast as it polls. Physics is integrated in SIM_STEP increments. The course
+// has walls, so bumping into one stalls the wheel on that side and squares
+// the robot up the same way the move_failsafe() calls rely on.
+//
+// Behaviour is configured through environment variables:
+//   SIM_LIGHT        ticket booth light color, "red" (default) or "blue"
+//   SIM_LIGHT_X/_Y   ticket booth light position in inches, measured from
+//                    the start light with the robot initially facing +y
+//   SIM_LEVER        correct fuel lever returned by RCS, 0-2 (default 1)
+//   SIM_START_DELAY  seconds before the start light turns on (default 1.0)
+//   SIM_LEFT_GAIN    left drivetrain efficiency (default 0.97)
+//   SIM_RIGHT_GAIN   right drivetrain efficiency (default 1.0)
+//   SIM_NOISE        CdS cell noise standard deviation in volts (default 0.015)
+//   SIM_SEED         noise generator seed (default 1)
+//   SIM_BATTERY      open circuit battery voltage at the start (default 11.5); the
+//                    pack sags under load and drains as the motors run
+//   SIM_SD           directory holding the files of the simulated SD card
+//                    (default sim/build/sd)
+//   SIM_TRACE        set to 1 to log every motor and servo command
+//   SIM_SKEW         set to 1 to report the time between the two writes of every
+//                    update that commands both drive motors, and which went first
+//   SIM_TIMEOUT      virtual seconds after which a stuck run is aborted (default 300)
+
+// Wiring, must match the port declarations in main.cpp
+#define SIM_RIGHT_MOTOR_PORT 0 // FEHMotor::Motor0
+#define SIM_LEFT_MOTOR_PORT 2 // FEHMotor::Motor2
+#define SIM_RIGHT_ENCODER_PIN 1 // FEHIO::P0_1
+#define SIM_LEFT_ENCODER_PIN 2 // FEHIO::P0_2
+#define SIM_CDS_PIN 8 // FEHIO::P1_0
+
+// Cost of each HAL call in seconds of virtual time
+#define SIM_COST_TIME 1e-6
+#define SIM_COST_ENCODER 2e-6
+#define SIM_COST_ADC 1.5e-5
+#define SIM_COST_MOTOR 4e-6
+#define SIM_COST_SERVO 4e-6
+#define SIM_COST_LCD_TEXT 2e-3
+#define SIM_COST_LCD_FILL 3e-2
+#define SIM_COST_SD 1e-3
+
+void sim_charge(double seconds);
+double sim_time();
+
+void sim_set_motor(int port, float percent, float max_voltage);
+void sim_set_servo(int port, float degree);
+int sim_encoder_counts(int pin);
+void sim_reset_encoder(int pin);
+float sim_analog_value(int pin);
+float sim_battery_voltage();
+int sim_correct_lever();
+
+void sim_log(const char *format, ...);
+
+#endif // SIM_H